@@ -0,0 +1,796 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+struct Ray {
+	vec3 origin;
+	vec3 direction;		// need not be normalized, t is in its units
+	float tMax;
+};
+
+struct RayHit {
+	float t;
+	unsigned int triangle;	// index in the triangle list given to build
+	float u, v;				// barycentrics of the triangle's second and third vertex
+};
+
+// ray through a point of the viewport given in NDC, t runs from the near plane (0) to the far plane (1)
+inline Ray viewRay(const mat4 &inverseViewProjection, const vec2 &ndc)
+{
+	vec4 nearPoint = inverseViewProjection * vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+	vec4 farPoint = inverseViewProjection * vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+	Ray ray;
+	ray.origin = vec3(nearPoint) / nearPoint.w;
+	ray.direction = vec3(farPoint) / farPoint.w - ray.origin;
+	ray.tMax = 1.0f;
+	return ray;
+}
+
+// the ray in the space of an affine transform given by its inverse, t keeps its meaning
+inline Ray transformRay(const Ray &ray, const mat4 &inverseTransform)
+{
+	Ray local;
+	local.origin = vec3(inverseTransform * vec4(ray.origin, 1.0f));
+	local.direction = mat3(inverseTransform) * ray.direction;
+	local.tMax = ray.tMax;
+	return local;
+}
+
+// 1 / direction with the zero components made huge instead of infinite, so the slab test never sees 0 * inf
+inline vec3 inverseDirection(const vec3 &direction)
+{
+	vec3 inv;
+	for (int i = 0; i < 3; i++)
+		inv[i] = fabs(direction[i]) > 1e-20f ? 1.0f / direction[i] : (direction[i] < 0 ? -1e30f : 1e30f);
+	return inv;
+}
+
+// entry distance of the ray into the box, FLT_MAX when it misses it or enters beyond tMax
+inline float rayBoxEntry(const vec3 &origin, const vec3 &invDirection, const vec3 &boxMin, const vec3 &boxMax, float tMax)
+{
+	float t0 = 0.0f, t1 = tMax;
+	for (int i = 0; i < 3; i++) {
+		float tNear = (boxMin[i] - origin[i]) * invDirection[i];
+		float tFar = (boxMax[i] - origin[i]) * invDirection[i];
+		if (tNear > tFar)
+			std::swap(tNear, tFar);
+		t0 = tNear > t0 ? tNear : t0;
+		t1 = tFar < t1 ? tFar : t1;
+	}
+	return t0 <= t1 ? t0 : FLT_MAX;
+}
+
+inline float surfaceArea(const AABB &box)
+{
+	if (!box.valid())
+		return 0.0f;
+	vec3 d = box.max - box.min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/*
+	Bounding volume hierarchy over a triangle list, for ray queries on the CPU.
+	Built top down: every node is split where the surface area heuristic is
+	lowest among BINS centroid bins per axis, and stays a leaf when no split
+	beats intersecting all its triangles. Nodes are 32 bytes with the two
+	children stored next to each other; the triangles are copied in leaf order
+	as (v0, e1, e2) for the Moller-Trumbore test, so a leaf is one contiguous
+	read.
+*/
+class TriangleBVH {
+public:
+	static const int BINS = 16;
+	static const int MAX_LEAF = 4;		// leaves are never split below this
+	static const int STACK = 64;		// traversal stack, the build keeps the depth below it
+
+	double buildMs;
+
+	TriangleBVH() : buildMs(0) {}
+
+	// indices holds three vertex indices per triangle
+	void build(const vector<vec3> &positions, const vector<unsigned int> &indices)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		size_t count = indices.size() / 3;
+		nodes.clear();
+		tris.clear();
+		ids.resize(count);
+
+		// bounds and centroid of every triangle, used by the whole build
+		vector<AABB> boxes(count);
+		vector<vec3> centroids(count);
+		for (size_t i = 0; i < count; i++) {
+			AABB box;
+			for (int k = 0; k < 3; k++)
+				box.expand(positions[indices[3 * i + k]]);
+			boxes[i] = box;
+			centroids[i] = box.center();
+			ids[i] = (unsigned int)i;
+		}
+
+		if (count > 0) {
+			nodes.reserve(2 * count);
+			Node root;
+			root.first = 0;
+			root.count = (unsigned int)count;
+			nodes.push_back(root);
+			// the root is alone, children then always start on an even index
+			nodes.push_back(root);
+			// node and depth; a pathological subtree reaching STACK levels just gets large leaves
+			vector<ivec2> stack;
+			stack.push_back(ivec2(0, 1));
+			while (!stack.empty()) {
+				ivec2 entry = stack.back();
+				stack.pop_back();
+				int split = subdivide(entry.x, boxes, centroids, entry.y < STACK);
+				if (split < 0)
+					continue;
+				stack.push_back(ivec2(split + 1, entry.y + 1));
+				stack.push_back(ivec2(split, entry.y + 1));
+			}
+		}
+
+		// triangles in leaf order
+		tris.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			const unsigned int *t = &indices[3 * ids[i]];
+			Tri &tri = tris[i];
+			tri.v0 = positions[t[0]];
+			tri.e1 = positions[t[1]] - tri.v0;
+			tri.e2 = positions[t[2]] - tri.v0;
+		}
+		buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	bool empty() const { return tris.empty(); }
+	size_t nodeCount() const { return nodes.empty() ? 0 : nodes.size() - 1; }
+	size_t triangleCount() const { return tris.size(); }
+
+	AABB bounds() const
+	{
+		return nodes.empty() ? AABB() : AABB(nodes[0].min, nodes[0].max);
+	}
+
+	// nearest hit closer than both ray.tMax and hit.t (FLT_MAX or an earlier hit), returns whether one was found
+	bool intersect(const Ray &ray, RayHit &hit) const
+	{
+		if (nodes.empty())
+			return false;
+		vec3 inv = inverseDirection(ray.direction);
+		bool found = false;
+		float tMax = std::min(hit.t, ray.tMax);
+		if (rayBoxEntry(ray.origin, inv, nodes[0].min, nodes[0].max, tMax) == FLT_MAX)
+			return false;
+
+		int stack[STACK];
+		float stackT[STACK];
+		int top = 0;
+		int index = 0;
+		for (;;) {
+			const Node &node = nodes[index];
+			if (node.count > 0) {
+				for (unsigned int i = node.first; i < node.first + node.count; i++) {
+					float t, u, v;
+					if (intersectTri(tris[i], ray, tMax, t, u, v)) {
+						tMax = t;
+						hit.t = t;
+						hit.triangle = ids[i];
+						hit.u = u;
+						hit.v = v;
+						found = true;
+					}
+				}
+			}
+			else {
+				// nearer child first, the farther one waits on the stack
+				int a = node.first, b = node.first + 1;
+				float ta = rayBoxEntry(ray.origin, inv, nodes[a].min, nodes[a].max, tMax);
+				float tb = rayBoxEntry(ray.origin, inv, nodes[b].min, nodes[b].max, tMax);
+				if (ta > tb) {
+					std::swap(ta, tb);
+					std::swap(a, b);
+				}
+				if (ta != FLT_MAX) {
+					if (tb != FLT_MAX) {
+						stackT[top] = tb;
+						stack[top++] = b;
+					}
+					index = a;
+					continue;
+				}
+			}
+			// next entry still in front of the nearest hit
+			for (;;) {
+				if (top == 0)
+					return found;
+				--top;
+				if (stackT[top] < tMax)
+					break;
+			}
+			index = stack[top];
+		}
+	}
+
+	// any hit before ray.tMax, for shadow rays
+	bool occluded(const Ray &ray) const
+	{
+		if (nodes.empty())
+			return false;
+		vec3 inv = inverseDirection(ray.direction);
+		// both children go on the stack, so it grows by one entry per level
+		int stack[STACK + 2];
+		int top = 0;
+		stack[top++] = 0;
+		while (top > 0) {
+			const Node &node = nodes[stack[--top]];
+			if (rayBoxEntry(ray.origin, inv, node.min, node.max, ray.tMax) == FLT_MAX)
+				continue;
+			if (node.count > 0) {
+				for (unsigned int i = node.first; i < node.first + node.count; i++) {
+					float t, u, v;
+					if (intersectTri(tris[i], ray, ray.tMax, t, u, v))
+						return true;
+				}
+			}
+			else {
+				stack[top++] = node.first + 1;
+				stack[top++] = node.first;
+			}
+		}
+		return false;
+	}
+
+	// memory held by the nodes and the copied triangles
+	size_t bytes() const
+	{
+		return nodes.capacity() * sizeof(Node) + tris.capacity() * sizeof(Tri) + ids.capacity() * sizeof(unsigned int);
+	}
+
+private:
+	// leaf when count > 0: triangles [first, first + count); otherwise children first and first + 1
+	struct Node {
+		vec3 min;
+		unsigned int first;
+		vec3 max;
+		unsigned int count;
+	};
+
+	struct Tri {
+		vec3 v0, e1, e2;
+	};
+
+	struct Bin {
+		AABB box;
+		unsigned int count;
+	};
+
+	vector<Node> nodes;
+	vector<Tri> tris;
+	vector<unsigned int> ids;		// original index of every triangle in leaf order
+
+	static bool intersectTri(const Tri &tri, const Ray &ray, float tMax, float &t, float &u, float &v)
+	{
+		vec3 p = cross(ray.direction, tri.e2);
+		float det = dot(tri.e1, p);
+		if (fabs(det) < 1e-12f)
+			return false;
+		float invDet = 1.0f / det;
+		vec3 s = ray.origin - tri.v0;
+		u = dot(s, p) * invDet;
+		if (u < 0.0f || u > 1.0f)
+			return false;
+		vec3 q = cross(s, tri.e1);
+		v = dot(ray.direction, q) * invDet;
+		if (v < 0.0f || u + v > 1.0f)
+			return false;
+		t = dot(tri.e2, q) * invDet;
+		return t > 0.0f && t < tMax;
+	}
+
+	// fits the node's bounds and splits it, returns the index of its first child or -1 for a leaf
+	int subdivide(int index, const vector<AABB> &boxes, const vector<vec3> &centroids, bool maySplit)
+	{
+		unsigned int first = nodes[index].first, count = nodes[index].count;
+		AABB box, centroidBox;
+		for (unsigned int i = first; i < first + count; i++) {
+			box.expand(boxes[ids[i]]);
+			centroidBox.expand(centroids[ids[i]]);
+		}
+		nodes[index].min = box.min;
+		nodes[index].max = box.max;
+		if (count <= (unsigned int)MAX_LEAF || !maySplit)
+			return -1;
+
+		// cheapest split over the centroid bins of the three axes
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float lo = centroidBox.min[axis], extent = centroidBox.max[axis] - lo;
+			if (extent <= 0.0f)
+				continue;
+			float scale = BINS / extent;
+			Bin bins[BINS];
+			for (int b = 0; b < BINS; b++)
+				bins[b].count = 0;
+			for (unsigned int i = first; i < first + count; i++) {
+				int b = std::min(BINS - 1, (int)((centroids[ids[i]][axis] - lo) * scale));
+				bins[b].count++;
+				bins[b].box.expand(boxes[ids[i]]);
+			}
+			// areas and counts left of every plane in one sweep, right of it in the other
+			float leftArea[BINS - 1], rightArea[BINS - 1];
+			unsigned int leftCount[BINS - 1], rightCount[BINS - 1];
+			AABB left, right;
+			unsigned int leftSum = 0, rightSum = 0;
+			for (int b = 0; b < BINS - 1; b++) {
+				leftSum += bins[b].count;
+				left.expand(bins[b].box);
+				leftCount[b] = leftSum;
+				leftArea[b] = surfaceArea(left);
+				rightSum += bins[BINS - 1 - b].count;
+				right.expand(bins[BINS - 1 - b].box);
+				rightCount[BINS - 2 - b] = rightSum;
+				rightArea[BINS - 2 - b] = surfaceArea(right);
+			}
+			for (int b = 0; b < BINS - 1; b++) {
+				if (leftCount[b] == 0 || rightCount[b] == 0)
+					continue;
+				float cost = leftArea[b] * leftCount[b] + rightArea[b] * rightCount[b];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = b;
+				}
+			}
+		}
+		if (bestAxis < 0 || bestCost >= surfaceArea(box) * count)
+			return -1;
+
+		// partition the ids around the chosen plane
+		float lo = centroidBox.min[bestAxis];
+		float scale = BINS / (centroidBox.max[bestAxis] - lo);
+		unsigned int *begin = &ids[first];
+		unsigned int *middle = std::partition(begin, begin + count, [&](unsigned int id) {
+			return std::min(BINS - 1, (int)((centroids[id][bestAxis] - lo) * scale)) <= bestSplit;
+		});
+		unsigned int leftCount = (unsigned int)(middle - begin);
+		if (leftCount == 0 || leftCount == count)
+			return -1;
+
+		int child = (int)nodes.size();
+		Node left, right;
+		left.first = first;
+		left.count = leftCount;
+		right.first = first + leftCount;
+		right.count = count - leftCount;
+		nodes.push_back(left);
+		nodes.push_back(right);
+		nodes[index].first = child;
+		nodes[index].count = 0;
+		return child;
+	}
+};
+
+inline AABB unite(const AABB &a, const AABB &b)
+{
+	AABB box = a;
+	box.expand(b);
+	return box;
+}
+
+inline bool contains(const AABB &outer, const AABB &inner)
+{
+	return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z
+		&& outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+inline bool overlaps(const AABB &a, const AABB &b)
+{
+	return a.min.x <= b.max.x && a.min.y <= b.max.y && a.min.z <= b.max.z
+		&& a.max.x >= b.min.x && a.max.y >= b.min.y && a.max.z >= b.min.z;
+}
+
+/*
+	Top level hierarchy over the world boxes of object instances, one instance
+	per leaf, kept up to date while they move instead of being rebuilt.
+	Leaf boxes are enlarged by margin so that small moves leave the tree alone;
+	a leaf that leaves its box gets a new one and its ancestors are refitted,
+	and at every ancestor a tree rotation (Kensler 2008) swaps a child with a
+	grandchild when that shrinks the child's box. New leaves go down to the
+	sibling with the cheapest surface area growth. The sum of the inner node
+	areas over the root area is the expected traversal cost; it is tracked on
+	every change, and once it exceeds rebuildRatio times its value after the
+	last rebuild the tree is rebuilt by median splits. Insert, remove and
+	update are O(log n), rebuilds are rare. Leaf ids stay valid throughout.
+*/
+class DynamicBVH {
+public:
+	static const int STACK = 64;		// traversal stack, the tree is rebuilt before it gets this deep
+
+	float margin;			// leaves are enlarged by this fraction of their size
+	float rebuildRatio;		// rebuild once the cost grew by this factor since the last rebuild
+
+	// statistics
+	size_t refits, rotations, rebuilds;
+
+	DynamicBVH() : margin(0.1f), rebuildRatio(1.5f), refits(0), rotations(0), rebuilds(0),
+		root(-1), freeList(-1), leaves(0), innerArea(0), builtCost(0) {}
+
+	void clear()
+	{
+		nodes.clear();
+		root = freeList = -1;
+		leaves = 0;
+		innerArea = 0;
+		builtCost = 0;
+	}
+
+	// returns the leaf id of the instance
+	int insert(const AABB &box, int instance)
+	{
+		int leaf = allocate();
+		nodes[leaf].box = fatten(box);
+		nodes[leaf].instance = instance;
+		leaves++;
+		insertLeaf(leaf);
+		checkQuality();
+		return leaf;
+	}
+
+	void remove(int leaf)
+	{
+		removeLeaf(leaf);
+		release(leaf);
+		leaves--;
+		checkQuality();
+	}
+
+	// the instance of a leaf has a new box, returns false when it still fits the old one and nothing changed
+	bool update(int leaf, const AABB &box)
+	{
+		if (contains(nodes[leaf].box, box))
+			return false;
+		nodes[leaf].box = fatten(box);
+		refitFrom(nodes[leaf].parent);
+		refits++;
+		checkQuality();
+		return true;
+	}
+
+	// median split rebuild over the current leaves
+	void rebuild()
+	{
+		vector<int> list;
+		freeList = -1;
+		for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+			if (nodes[i].height == 0) {
+				list.push_back(i);
+			}
+			else {
+				nodes[i].height = -1;
+				nodes[i].parent = freeList;
+				freeList = i;
+			}
+		}
+		innerArea = 0;
+		root = list.empty() ? -1 : buildRange(list, 0, (unsigned int)list.size(), -1);
+		builtCost = cost();
+		rebuilds++;
+	}
+
+	bool empty() const { return root < 0; }
+	size_t leafCount() const { return leaves; }
+	int height() const { return root < 0 ? 0 : nodes[root].height; }
+
+	// inner node area over root area, the expected number of inner nodes a ray visits
+	float cost() const
+	{
+		if (root < 0)
+			return 0.0f;
+		float rootArea = surfaceArea(nodes[root].box);
+		return rootArea > 0 ? float(innerArea / rootArea) : 0.0f;
+	}
+
+	// visit(instance, tMax) tests one instance, lowers tMax to its hit and returns true when it is nearer;
+	// instances are visited roughly nearest first, returns whether any was hit
+	template <class Visit> bool intersect(const Ray &ray, float &tMax, Visit visit) const
+	{
+		if (root < 0)
+			return false;
+		vec3 inv = inverseDirection(ray.direction);
+		tMax = std::min(tMax, ray.tMax);
+		if (rayBoxEntry(ray.origin, inv, nodes[root].box.min, nodes[root].box.max, tMax) == FLT_MAX)
+			return false;
+		bool found = false;
+		int stack[STACK];
+		float stackT[STACK];
+		int top = 0;
+		int index = root;
+		for (;;) {
+			const Node &node = nodes[index];
+			if (node.height == 0) {
+				if (visit(node.instance, tMax))
+					found = true;
+			}
+			else {
+				int a = node.child[0], b = node.child[1];
+				float ta = rayBoxEntry(ray.origin, inv, nodes[a].box.min, nodes[a].box.max, tMax);
+				float tb = rayBoxEntry(ray.origin, inv, nodes[b].box.min, nodes[b].box.max, tMax);
+				if (ta > tb) {
+					std::swap(ta, tb);
+					std::swap(a, b);
+				}
+				if (ta != FLT_MAX) {
+					if (tb != FLT_MAX) {
+						stackT[top] = tb;
+						stack[top++] = b;
+					}
+					index = a;
+					continue;
+				}
+			}
+			for (;;) {
+				if (top == 0)
+					return found;
+				--top;
+				if (stackT[top] < tMax)
+					break;
+			}
+			index = stack[top];
+		}
+	}
+
+	// visit(instance) for every leaf box that may be inside the frustum
+	template <class Visit> void query(const Frustum &frustum, Visit visit) const
+	{
+		queryNodes([&](const AABB &box) { return frustum.testAABB(box); }, visit);
+	}
+
+	// visit(instance) for every leaf box overlapping the box
+	template <class Visit> void query(const AABB &box, Visit visit) const
+	{
+		queryNodes([&](const AABB &node) { return overlaps(node, box); }, visit);
+	}
+
+private:
+	// leaf when height is 0, free when -1 (parent is then the next free node)
+	struct Node {
+		AABB box;
+		int parent;
+		int child[2];
+		int height;
+		int instance;
+	};
+
+	vector<Node> nodes;
+	int root;
+	int freeList;
+	size_t leaves;
+	double innerArea;		// sum of the inner node areas, kept by setBox
+	float builtCost;
+
+	template <class Test, class Visit> void queryNodes(Test test, Visit visit) const
+	{
+		if (root < 0)
+			return;
+		int stack[STACK + 2];
+		int top = 0;
+		stack[top++] = root;
+		while (top > 0) {
+			const Node &node = nodes[stack[--top]];
+			if (!test(node.box))
+				continue;
+			if (node.height == 0) {
+				visit(node.instance);
+			}
+			else {
+				stack[top++] = node.child[1];
+				stack[top++] = node.child[0];
+			}
+		}
+	}
+
+	AABB fatten(const AABB &box) const
+	{
+		vec3 grow = (box.max - box.min) * margin;
+		float least = std::max(std::max(grow.x, grow.y), grow.z) * 0.5f;
+		grow = glm::max(grow, vec3(least));
+		return AABB(box.min - grow, box.max + grow);
+	}
+
+	int allocate()
+	{
+		int index;
+		if (freeList >= 0) {
+			index = freeList;
+			freeList = nodes[index].parent;
+		}
+		else {
+			index = (int)nodes.size();
+			nodes.push_back(Node());
+		}
+		Node &node = nodes[index];
+		node.box = AABB();
+		node.parent = -1;
+		node.child[0] = node.child[1] = -1;
+		node.height = 0;
+		node.instance = -1;
+		return index;
+	}
+
+	void release(int index)
+	{
+		if (nodes[index].height > 0)
+			innerArea -= surfaceArea(nodes[index].box);
+		nodes[index].height = -1;
+		nodes[index].parent = freeList;
+		freeList = index;
+	}
+
+	// inner nodes only, keeps innerArea
+	void setBox(int index, const AABB &box)
+	{
+		innerArea += surfaceArea(box) - surfaceArea(nodes[index].box);
+		nodes[index].box = box;
+	}
+
+	void fitNode(int index)
+	{
+		Node &node = nodes[index];
+		node.height = 1 + std::max(nodes[node.child[0]].height, nodes[node.child[1]].height);
+		setBox(index, unite(nodes[node.child[0]].box, nodes[node.child[1]].box));
+	}
+
+	void replaceChild(int parent, int from, int to)
+	{
+		if (parent < 0)
+			root = to;
+		else
+			nodes[parent].child[nodes[parent].child[0] == from ? 0 : 1] = to;
+		nodes[to].parent = parent;
+	}
+
+	void insertLeaf(int leaf)
+	{
+		if (root < 0) {
+			root = leaf;
+			nodes[leaf].parent = -1;
+			return;
+		}
+		// walk down while pushing the leaf into a child costs less than pairing it with the node
+		AABB box = nodes[leaf].box;
+		int index = root;
+		while (nodes[index].height > 0) {
+			const Node &node = nodes[index];
+			float combined = surfaceArea(unite(node.box, box));
+			float here = combined;
+			// every level below grows by what this one grows
+			float inherited = combined - surfaceArea(node.box);
+			float cost[2];
+			for (int k = 0; k < 2; k++) {
+				const Node &child = nodes[node.child[k]];
+				float grown = surfaceArea(unite(child.box, box));
+				cost[k] = inherited + (child.height == 0 ? grown : grown - surfaceArea(child.box));
+			}
+			if (here <= cost[0] && here <= cost[1])
+				break;
+			index = node.child[cost[0] <= cost[1] ? 0 : 1];
+		}
+
+		int parent = allocate();
+		replaceChild(nodes[index].parent, index, parent);
+		nodes[parent].child[0] = index;
+		nodes[parent].child[1] = leaf;
+		nodes[index].parent = parent;
+		nodes[leaf].parent = parent;
+		refitFrom(parent);
+	}
+
+	void removeLeaf(int leaf)
+	{
+		if (leaf == root) {
+			root = -1;
+			return;
+		}
+		int parent = nodes[leaf].parent;
+		int grand = nodes[parent].parent;
+		int sibling = nodes[parent].child[nodes[parent].child[0] == leaf ? 1 : 0];
+		replaceChild(grand, parent, sibling);
+		release(parent);
+		refitFrom(grand);
+	}
+
+	// refits the boxes from index up to the root, rotating on the way
+	void refitFrom(int index)
+	{
+		while (index >= 0) {
+			fitNode(index);
+			rotate(index);
+			index = nodes[index].parent;
+		}
+	}
+
+	// swaps a child with a grandchild under the other child when that shrinks the other child most
+	void rotate(int index)
+	{
+		int best = -1, bestGrand = -1;
+		float bestGain = 0.0f;
+		for (int k = 0; k < 2; k++) {
+			int child = nodes[index].child[k], other = nodes[index].child[1 - k];
+			if (nodes[other].height == 0)
+				continue;
+			float area = surfaceArea(nodes[other].box);
+			for (int g = 0; g < 2; g++) {
+				// child goes under other in place of grand, which comes up next to it
+				int grand = nodes[other].child[g], kept = nodes[other].child[1 - g];
+				float gain = area - surfaceArea(unite(nodes[child].box, nodes[kept].box));
+				if (gain > bestGain + 1e-6f * area) {
+					bestGain = gain;
+					best = child;
+					bestGrand = grand;
+				}
+			}
+		}
+		if (best < 0)
+			return;
+		int other = nodes[bestGrand].parent;
+		nodes[index].child[nodes[index].child[0] == best ? 0 : 1] = bestGrand;
+		nodes[bestGrand].parent = index;
+		nodes[other].child[nodes[other].child[0] == bestGrand ? 0 : 1] = best;
+		nodes[best].parent = other;
+		fitNode(other);
+		fitNode(index);
+		rotations++;
+	}
+
+	void checkQuality()
+	{
+		if (root < 0)
+			return;
+		if (builtCost <= 0.0f)
+			builtCost = cost();
+		if (nodes[root].height >= STACK - 2 || cost() > builtCost * rebuildRatio)
+			rebuild();
+	}
+
+	int buildRange(vector<int> &list, unsigned int first, unsigned int count, int parent)
+	{
+		if (count == 1) {
+			nodes[list[first]].parent = parent;
+			return list[first];
+		}
+		AABB centroidBox;
+		for (unsigned int i = first; i < first + count; i++)
+			centroidBox.expand(nodes[list[i]].box.center());
+		vec3 extent = centroidBox.max - centroidBox.min;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		unsigned int half = count / 2;
+		int *begin = &list[first];
+		std::nth_element(begin, begin + half, begin + count, [&](int a, int b) {
+			return nodes[a].box.center()[axis] < nodes[b].box.center()[axis];
+		});
+
+		int index = allocate();
+		nodes[index].parent = parent;
+		int left = buildRange(list, first, half, index);
+		int right = buildRange(list, first + half, count - half, index);
+		nodes[index].child[0] = left;
+		nodes[index].child[1] = right;
+		fitNode(index);
+		return index;
+	}
+};
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <cstdlib>
+#include <cfloat>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define CULLING_SSE 1
+#endif
+
+using namespace std;
+using namespace glm;
+
+// axis aligned bounding box
+struct AABB {
+	vec3 min;
+	vec3 max;
+
+	AABB() : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+	AABB(vec3 min, vec3 max) : min(min), max(max) {}
+
+	bool valid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+	vec3 center() const { return (min + max) * 0.5f; }
+	vec3 extent() const { return (max - min) * 0.5f; }
+
+	void expand(const vec3 &p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	void expand(const AABB &box)
+	{
+		if (!box.valid())
+			return;
+		min = glm::min(min, box.min);
+		max = glm::max(max, box.max);
+	}
+};
+
+struct BoundingSphere {
+	vec3 center;
+	float radius;
+};
+
+// transforms a box by an affine matrix and returns the box around the result (Arvo's method)
+inline AABB transformAABB(const AABB &box, const mat4 &m)
+{
+	if (!box.valid())
+		return box;
+	vec3 center = vec3(m * vec4(box.center(), 1.0f));
+	vec3 extent = box.extent();
+	vec3 worldExtent;
+	for (int i = 0; i < 3; i++)
+		worldExtent[i] = fabs(m[0][i]) * extent.x + fabs(m[1][i]) * extent.y + fabs(m[2][i]) * extent.z;
+	return AABB(center - worldExtent, center + worldExtent);
+}
+
+inline BoundingSphere sphereOf(const AABB &box)
+{
+	BoundingSphere sphere;
+	sphere.center = box.center();
+	sphere.radius = box.valid() ? length(box.extent()) : 0.0f;
+	return sphere;
+}
+
+/*
+	Six clip planes extracted from projection * view (Gribb/Hartmann).
+	Planes are stored structure-of-arrays and normalized, so a plane distance
+	is a true world space distance and can be compared with a sphere radius.
+*/
+class Frustum {
+public:
+	float a[6], b[6], c[6], d[6];
+
+	Frustum() {}
+	Frustum(const mat4 &viewProjection) { extract(viewProjection); }
+
+	void extract(const mat4 &m)
+	{
+		// rows of the column-major glm matrix
+		vec4 row[4];
+		for (int i = 0; i < 4; i++)
+			row[i] = vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+		vec4 plane[6] = {
+			row[3] + row[0],	// left
+			row[3] - row[0],	// right
+			row[3] + row[1],	// bottom
+			row[3] - row[1],	// top
+			row[3] + row[2],	// near
+			row[3] - row[2]		// far
+		};
+		for (int i = 0; i < 6; i++) {
+			float len = length(vec3(plane[i]));
+			a[i] = plane[i].x / len;
+			b[i] = plane[i].y / len;
+			c[i] = plane[i].z / len;
+			d[i] = plane[i].w / len;
+		}
+	}
+
+	bool testSphere(const vec3 &center, float radius) const
+	{
+		for (int i = 0; i < 6; i++) {
+			if (a[i] * center.x + b[i] * center.y + c[i] * center.z + d[i] < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	bool testAABB(const AABB &box) const
+	{
+		if (!box.valid())
+			return false;
+		for (int i = 0; i < 6; i++) {
+			// the box corner furthest along the plane normal
+			float x = a[i] >= 0 ? box.max.x : box.min.x;
+			float y = b[i] >= 0 ? box.max.y : box.min.y;
+			float z = c[i] >= 0 ? box.max.z : box.min.z;
+			if (a[i] * x + b[i] * y + c[i] * z + d[i] < 0)
+				return false;
+		}
+		return true;
+	}
+};
+
+/*
+	Bounding spheres kept structure-of-arrays, padded to a multiple of four so
+	that cullSpheres can test four of them against a plane per instruction.
+*/
+class SphereSet {
+public:
+	vector<float> x, y, z, r;
+
+	void clear()
+	{
+		x.clear(); y.clear(); z.clear(); r.clear();
+		count = 0;
+	}
+
+	size_t size() const { return count; }
+
+	void push(const BoundingSphere &sphere)
+	{
+		if (count == x.size()) {
+			size_t padded = count + 4;
+			// padding entries are never visible: radius -inf fails every plane
+			x.resize(padded, 0.0f); y.resize(padded, 0.0f); z.resize(padded, 0.0f); r.resize(padded, -FLT_MAX);
+		}
+		set(count++, sphere);
+	}
+
+	void set(size_t i, const BoundingSphere &sphere)
+	{
+		x[i] = sphere.center.x;
+		y[i] = sphere.center.y;
+		z[i] = sphere.center.z;
+		r[i] = sphere.radius;
+	}
+
+private:
+	size_t count = 0;
+};
+
+// writes 1 into visible[i] for every sphere that intersects the frustum, 0 otherwise
+inline void cullSpheres(const Frustum &frustum, const SphereSet &spheres, vector<unsigned char> &visible)
+{
+	size_t padded = spheres.x.size();
+	visible.resize(padded);
+#ifdef CULLING_SSE
+	__m128 pa[6], pb[6], pc[6], pd[6];
+	for (int p = 0; p < 6; p++) {
+		pa[p] = _mm_set1_ps(frustum.a[p]);
+		pb[p] = _mm_set1_ps(frustum.b[p]);
+		pc[p] = _mm_set1_ps(frustum.c[p]);
+		pd[p] = _mm_set1_ps(frustum.d[p]);
+	}
+	const __m128 zero = _mm_setzero_ps();
+	for (size_t i = 0; i < padded; i += 4) {
+		__m128 x = _mm_loadu_ps(&spheres.x[i]);
+		__m128 y = _mm_loadu_ps(&spheres.y[i]);
+		__m128 z = _mm_loadu_ps(&spheres.z[i]);
+		__m128 negr = _mm_sub_ps(zero, _mm_loadu_ps(&spheres.r[i]));
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < 6; p++) {
+			__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pa[p], x), _mm_mul_ps(pb[p], y)),
+				_mm_add_ps(_mm_mul_ps(pc[p], z), pd[p]));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(dist, negr));
+		}
+		int mask = _mm_movemask_ps(inside);
+		visible[i] = mask & 1;
+		visible[i + 1] = (mask >> 1) & 1;
+		visible[i + 2] = (mask >> 2) & 1;
+		visible[i + 3] = (mask >> 3) & 1;
+	}
+#else
+	for (size_t i = 0; i < padded; i++)
+		visible[i] = frustum.testSphere(vec3(spheres.x[i], spheres.y[i], spheres.z[i]), spheres.r[i]);
+#endif
+	visible.resize(spheres.size());
+}
+
+// times cullSpheres over 10k to 100k random objects, run with "--bench-cull"
+inline void benchmarkCulling()
+{
+	mat4 projection = perspective(radians(45.0f), 1400.0f / 600.0f, 0.1f, 100.0f);
+	mat4 view = lookAt(vec3(0.0f, 0.5f, 3.0f), vec3(0.0f, 0.5f, 2.0f), vec3(0, 1, 0));
+	Frustum frustum(projection * view);
+
+	const int counts[] = { 10000, 25000, 50000, 100000 };
+	srand(1);
+	for (int count : counts) {
+		SphereSet spheres;
+		for (int i = 0; i < count; i++) {
+			BoundingSphere sphere;
+			sphere.center = vec3(rand() % 2000 / 10.0f - 100.0f, rand() % 200 / 10.0f - 10.0f, rand() % 2000 / 10.0f - 100.0f);
+			sphere.radius = rand() % 100 / 50.0f;
+			spheres.push(sphere);
+		}
+
+		vector<unsigned char> visible;
+		const int rounds = 200;
+		auto start = chrono::high_resolution_clock::now();
+		for (int k = 0; k < rounds; k++)
+			cullSpheres(frustum, spheres, visible);
+		double ms = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count() / rounds;
+
+		size_t visibleCount = 0;
+		for (int i = 0; i < count; i++)
+			visibleCount += visible[i];
+		cout << count << " objects: " << ms << " ms per cull, " << count / ms / 1000.0 << " M spheres/s, "
+			<< visibleCount << " visible" << endl;
+	}
+}
+
+#endif
@@ -0,0 +1,89 @@
+#ifndef DYNRES_H
+#define DYNRES_H
+
+#include <glm/glm.hpp>
+
+#include "gputimer.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Dynamic resolution: the eyes are rendered at scale x their viewport size
+	per axis and stretched over it, with the scale steered so that the GPU
+	time of a stereo frame stays under budgetMs. The time of every frame is
+	measured by a GpuTimer and smoothed; as it goes roughly with the number of
+	pixels, the scale moves by the square root of budget over time, aiming 10%
+	below the budget. Each step is limited, more so upwards, and rounded to
+	1/64 so that noise does not change the size every frame. The scale is
+	latched by beginFrame, both eyes of a frame have the same size.
+*/
+class DynamicResolution {
+public:
+	bool enabled;
+	float budgetMs;		// GPU time allowed for a stereo frame
+	float minScale;		// the eyes never get smaller than this share of their viewport per axis
+	float scale;		// for the next frames
+	double gpuMs;		// smoothed GPU time of the measured frames, -1 before the first
+	int changes;		// how often the scale moved
+
+	DynamicResolution() : enabled(false), budgetMs(16.0f), minScale(0.5f), scale(1.0f), gpuMs(-1.0), changes(0),
+		frameScale(1.0f), timing(false) {}
+
+	// size in pixels of a viewport side at the scale of the current frame
+	int scaled(int size) const
+	{
+		return std::max(1, int(size * frameScale + 0.5f));
+	}
+
+	void beginFrame()
+	{
+		timing = enabled;
+		frameScale = enabled ? scale : 1.0f;
+		if (timing)
+			timer.begin();
+	}
+
+	void release()
+	{
+		timer.release();
+		timing = false;
+	}
+
+	void endFrame()
+	{
+		if (!timing)
+			return;
+		timer.end();
+		if (timer.poll())
+			adjust(timer.lastMs);
+	}
+
+private:
+	GpuTimer timer;
+	float frameScale;
+	bool timing;
+
+	void adjust(double ms)
+	{
+		// a single hitch (a shader compile, a driver stall) must not swamp the average
+		ms = std::min(ms, budgetMs * 4.0);
+		gpuMs = gpuMs < 0 ? ms : gpuMs * 0.7 + ms * 0.3;
+		if (gpuMs <= 0)
+			return;
+		float wanted = scale * sqrt(float(budgetMs * 0.9 / gpuMs));
+		// quick to shed load, slow to take it back
+		wanted = glm::clamp(wanted, scale * 0.9f, scale * 1.05f);
+		wanted = glm::clamp(wanted, minScale, 1.0f);
+		wanted = floor(wanted * 64.0f + 0.5f) / 64.0f;
+		if (wanted != scale) {
+			scale = wanted;
+			changes++;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef FOVEATION_H
+#define FOVEATION_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "rendertarget.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+enum FoveaMode {
+	FOVEA_OFF,			// every pixel of the eye shaded at full resolution
+	FOVEA_CENTRE,		// the inset stays in the middle of each eye
+	FOVEA_CURSOR		// the inset follows the cursor while it is visible
+};
+
+/*
+	Foveated rendering with two nested targets per eye. The whole eye is
+	rendered into the periphery target at peripheryScale of its viewport per
+	axis, and a rectangle of insetSize of the eye around the fovea is rendered
+	again at full resolution into the inset target, with the projection
+	cropped to that rectangle so it lines up exactly (and the frustum culling
+	and light clusters only see what the inset covers). Before the periphery
+	is drawn its depth is cleared to 0 under the inset, so the hidden part
+	fails the depth test and costs no shading. composite() stretches the
+	periphery over the viewport and blends the inset on top, faded in over
+	feather pixels so the seam does not show; sides of the inset that touch
+	the edge of the eye are not faded.
+	The fragment work of an eye drops to about insetSize^2 + peripheryScale^2
+	of the full one.
+*/
+class FoveatedRenderer {
+public:
+	float insetSize;		// share of the eye per axis at full resolution
+	float peripheryScale;	// resolution of the rest, per axis
+	int feather;			// viewport pixels over which the inset fades in
+
+	// of the eye set up last, in pixels
+	int peripheryWidth, peripheryHeight;
+	ivec4 inset;			// (x, y, width, height) inside the eye viewport, rendered 1:1
+
+	FoveatedRenderer() : insetSize(0.4f), peripheryScale(0.5f), feather(16),
+		peripheryWidth(0), peripheryHeight(0), inset(0), eyeWidth(0), eyeHeight(0), vao(0) {}
+
+	FoveatedRenderer(const FoveatedRenderer &) = delete;
+	FoveatedRenderer &operator=(const FoveatedRenderer &) = delete;
+
+	~FoveatedRenderer()
+	{
+		if (vao)
+			glDeleteVertexArrays(1, &vao);
+	}
+
+	/*
+		sizes both targets for an eye of width x height viewport pixels; centre is the
+		fovea in 0..1 of the eye, scale shrinks the periphery further (dynamic resolution)
+	*/
+	void setup(int width, int height, vec2 centre, float scale = 1.0f)
+	{
+		eyeWidth = width;
+		eyeHeight = height;
+		// allocated for the full periphery, the scale only uses less of it
+		float full = glm::clamp(peripheryScale, 0.05f, 1.0f), periphery = full * glm::clamp(scale, 0.05f, 1.0f);
+		peripheryTarget.resize(std::max(1, int(ceil(width * full))), std::max(1, int(ceil(height * full))));
+		peripheryWidth = std::min(std::max(1, int(ceil(width * periphery))), peripheryTarget.width);
+		peripheryHeight = std::min(std::max(1, int(ceil(height * periphery))), peripheryTarget.height);
+
+		float size = glm::clamp(insetSize, 0.0f, 1.0f);
+		inset.z = std::max(1, int(width * size + 0.5f));
+		inset.w = std::max(1, int(height * size + 0.5f));
+		inset.x = glm::clamp(int(centre.x * width - inset.z * 0.5f + 0.5f), 0, width - inset.z);
+		inset.y = glm::clamp(int(centre.y * height - inset.w * 0.5f + 0.5f), 0, height - inset.w);
+		insetTarget.resize(inset.z, inset.w);
+		if (!vao)
+			glGenVertexArrays(1, &vao);
+	}
+
+	/*
+		binds and clears the periphery target; the caller then renders the eye into
+		(0, 0, peripheryWidth, peripheryHeight) without clearing
+	*/
+	void bindPeriphery() const
+	{
+		peripheryTarget.bind();
+		glViewport(0, 0, peripheryWidth, peripheryHeight);
+		glScissor(0, 0, peripheryWidth, peripheryHeight);
+		glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// only periphery pixels that are not even read by the filtered stretch of the faded border
+		float sx = float(peripheryWidth) / eyeWidth, sy = float(peripheryHeight) / eyeHeight;
+		int x0 = int(ceil((inset.x + feather) * sx)) + 1, x1 = int(floor((inset.x + inset.z - feather) * sx)) - 1;
+		int y0 = int(ceil((inset.y + feather) * sy)) + 1, y1 = int(floor((inset.y + inset.w - feather) * sy)) - 1;
+		if (x1 > x0 && y1 > y0) {
+			glScissor(x0, y0, x1 - x0, y1 - y0);
+			glClearDepth(0.0);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glClearDepth(1.0);
+		}
+	}
+
+	// binds the inset target, the eye goes into (0, 0, inset.z, inset.w) with insetCrop() * projection
+	void bindInset() const
+	{
+		insetTarget.bind();
+	}
+
+	// maps the inset rectangle of the eye's clip space onto the whole of clip space
+	mat4 insetCrop() const
+	{
+		vec2 low(2.0f * inset.x / eyeWidth - 1.0f, 2.0f * inset.y / eyeHeight - 1.0f);
+		vec2 high(2.0f * (inset.x + inset.z) / eyeWidth - 1.0f, 2.0f * (inset.y + inset.w) / eyeHeight - 1.0f);
+		mat4 crop = scale(mat4(1.0f), vec3(2.0f / (high.x - low.x), 2.0f / (high.y - low.y), 1.0f));
+		crop = translate(crop, vec3(-(low.x + high.x) * 0.5f, -(low.y + high.y) * 0.5f, 0.0f));
+		return crop;
+	}
+
+	// both targets into viewport of framebuffer, which must be eyeWidth x eyeHeight
+	void composite(Shader &shader, unsigned int framebuffer, const vec4 &viewport) const
+	{
+		peripheryTarget.blit(peripheryWidth, peripheryHeight, framebuffer, viewport);
+
+		int x = (int)viewport.x + inset.x, y = (int)viewport.y + inset.y;
+		glViewport(x, y, inset.z, inset.w);
+		glScissor(x, y, inset.z, inset.w);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		// a side on the edge of the eye has nothing to fade into
+		float far = float(eyeWidth + eyeHeight);
+		shader.use();
+		shader.setVec2("origin", (float)x, (float)y);
+		shader.setVec2("size", (float)inset.z, (float)inset.w);
+		shader.setVec2("lowMargin", inset.x == 0 ? far : 0.0f, inset.y == 0 ? far : 0.0f);
+		shader.setVec2("highMargin", inset.x + inset.z == eyeWidth ? far : 0.0f, inset.y + inset.w == eyeHeight ? far : 0.0f);
+		shader.setFloat("feather", (float)std::max(feather, 1));
+		shader.setInt("inset", 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, insetTarget.color);
+		glBindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	// at most this share of the full resolution fragments is shaded for the last eye set up
+	float shadedFraction() const
+	{
+		if (eyeWidth <= 0 || eyeHeight <= 0)
+			return 1.0f;
+		return float(peripheryWidth * peripheryHeight + inset.z * inset.w) / (float(eyeWidth) * eyeHeight);
+	}
+
+private:
+	int eyeWidth, eyeHeight;
+	TextureTarget peripheryTarget, insetTarget;
+	unsigned int vao;		// empty, the shader makes its vertices from gl_VertexID
+};
+
+#endif
@@ -0,0 +1,343 @@
+#ifndef GLCALLS_H
+#define GLCALLS_H
+
+#include <glad/glad.h>
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+
+/*
+	Counts and times the GL calls of the renderer, built with -DGL_CALLS only;
+	without it the GL_CALLS_* macros expand to nothing. glad calls every entry
+	point through a pointer (glDrawElements is glad_glDrawElements), so once
+	glad is loaded install() swaps the pointers of GL_CALLS_LIST for wrappers
+	that count the call, time it and call the driver. It needs no window
+	system and works the same headless. The time is what the call costs the
+	CPU, the driver usually queues the work for later; the GPU side is the
+	profiler's. Calls made between beginFrame and endFrame are also counted
+	per frame. capture() writes every call of the next frame with its
+	arguments to a file, to see which calls a pass repeats.
+	A function missing from the list is not counted, add it there.
+	Main thread only, like the GL calls.
+*/
+#ifdef GL_CALLS
+
+// every GL 3.3 function the renderer calls
+#define GL_CALLS_LIST(X) \
+	X(glActiveTexture) \
+	X(glAttachShader) \
+	X(glBeginQuery) \
+	X(glBindBuffer) \
+	X(glBindBufferRange) \
+	X(glBindFramebuffer) \
+	X(glBindRenderbuffer) \
+	X(glBindTexture) \
+	X(glBindVertexArray) \
+	X(glBlendFunc) \
+	X(glBlitFramebuffer) \
+	X(glBufferData) \
+	X(glBufferSubData) \
+	X(glCheckFramebufferStatus) \
+	X(glClear) \
+	X(glClearColor) \
+	X(glClearDepth) \
+	X(glClearStencil) \
+	X(glClientWaitSync) \
+	X(glColorMask) \
+	X(glCompileShader) \
+	X(glCreateProgram) \
+	X(glCreateShader) \
+	X(glDeleteBuffers) \
+	X(glDeleteFramebuffers) \
+	X(glDeleteProgram) \
+	X(glDeleteQueries) \
+	X(glDeleteRenderbuffers) \
+	X(glDeleteShader) \
+	X(glDeleteSync) \
+	X(glDeleteTextures) \
+	X(glDeleteVertexArrays) \
+	X(glDepthFunc) \
+	X(glDepthMask) \
+	X(glDisable) \
+	X(glDrawArrays) \
+	X(glDrawBuffer) \
+	X(glDrawElements) \
+	X(glEnable) \
+	X(glEnableVertexAttribArray) \
+	X(glEndQuery) \
+	X(glFenceSync) \
+	X(glFinish) \
+	X(glFramebufferRenderbuffer) \
+	X(glFramebufferTexture) \
+	X(glFramebufferTexture2D) \
+	X(glGenBuffers) \
+	X(glGenFramebuffers) \
+	X(glGenQueries) \
+	X(glGenRenderbuffers) \
+	X(glGenTextures) \
+	X(glGenVertexArrays) \
+	X(glGenerateMipmap) \
+	X(glGetIntegerv) \
+	X(glGetProgramInfoLog) \
+	X(glGetProgramiv) \
+	X(glGetQueryObjectiv) \
+	X(glGetQueryObjectui64v) \
+	X(glGetShaderInfoLog) \
+	X(glGetShaderiv) \
+	X(glGetString) \
+	X(glGetStringi) \
+	X(glGetUniformBlockIndex) \
+	X(glGetUniformLocation) \
+	X(glIsEnabled) \
+	X(glLinkProgram) \
+	X(glMapBufferRange) \
+	X(glPixelStorei) \
+	X(glQueryCounter) \
+	X(glReadBuffer) \
+	X(glReadPixels) \
+	X(glRenderbufferStorage) \
+	X(glScissor) \
+	X(glShaderSource) \
+	X(glStencilFunc) \
+	X(glStencilMask) \
+	X(glStencilOp) \
+	X(glTexBuffer) \
+	X(glTexImage2D) \
+	X(glTexParameteri) \
+	X(glTexSubImage2D) \
+	X(glUniform1f) \
+	X(glUniform1i) \
+	X(glUniform2f) \
+	X(glUniform2fv) \
+	X(glUniform3f) \
+	X(glUniform3fv) \
+	X(glUniform4f) \
+	X(glUniform4fv) \
+	X(glUniformBlockBinding) \
+	X(glUniformMatrix2fv) \
+	X(glUniformMatrix3fv) \
+	X(glUniformMatrix4fv) \
+	X(glUnmapBuffer) \
+	X(glUseProgram) \
+	X(glVertexAttribPointer) \
+	X(glViewport)
+
+enum GlCall {
+#define GL_CALLS_ENUM(name) GL_CALL_##name,
+	GL_CALLS_LIST(GL_CALLS_ENUM)
+#undef GL_CALLS_ENUM
+	GL_CALL_COUNT
+};
+
+class GlCalls;
+inline GlCalls &glCalls();
+
+class GlCalls {
+public:
+	struct Entry {
+		unsigned long long calls;
+		double ms;
+		unsigned long long frameCalls;		// of the calls, made inside a frame
+		double frameMs;
+		Entry() : calls(0), ms(0.0), frameCalls(0), frameMs(0.0) {}
+	};
+
+	Entry entries[GL_CALL_COUNT];
+	int frames;			// ended so far
+
+	GlCalls() : frames(0), inFrame(false), armed(false), logged(0) {}
+
+	GlCalls(const GlCalls &) = delete;
+	GlCalls &operator=(const GlCalls &) = delete;
+
+	static const char *name(int call)
+	{
+		static const char *names[GL_CALL_COUNT] = {
+#define GL_CALLS_NAME(name) #name,
+			GL_CALLS_LIST(GL_CALLS_NAME)
+#undef GL_CALLS_NAME
+		};
+		return names[call];
+	}
+
+	// after gladLoadGL*, wraps the pointers it loaded; again after every load
+	void install()
+	{
+#define GL_CALLS_HOOK(name) hook<GL_CALL_##name>(glad_##name);
+		GL_CALLS_LIST(GL_CALLS_HOOK)
+#undef GL_CALLS_HOOK
+	}
+
+	void beginFrame()
+	{
+		inFrame = true;
+		if (armed) {
+			armed = false;
+			log.open(logPath.c_str());
+			if (!log)
+				cout << "ERROR::GL_CALLS:: cannot write " << logPath << endl;
+			logged = 0;
+		}
+	}
+
+	void endFrame()
+	{
+		inFrame = false;
+		frames++;
+		if (log.is_open()) {
+			log.close();
+			cout << "* gl calls: " << logged << " calls of frame " << frames << " written to " << logPath << endl;
+		}
+	}
+
+	// writes every call of the next frame to path
+	void capture(const string &path)
+	{
+		logPath = path;
+		armed = true;
+	}
+
+	// the entry points called so far, the most expensive first
+	void report(ostream &out) const
+	{
+		vector<int> order;
+		for (int i = 0; i < GL_CALL_COUNT; i++)
+			if (entries[i].calls)
+				order.push_back(i);
+		sort(order.begin(), order.end(), [this](int a, int b) { return entries[a].ms > entries[b].ms; });
+
+		out << "* gl calls over " << frames << " frames: calls, ms and ns per call in total, calls and ms per frame" << endl;
+		out << fixed;
+		for (unsigned int i = 0; i < order.size(); i++) {
+			const Entry &entry = entries[order[i]];
+			out << "  " << left << setw(26) << name(order[i]) << right
+				<< setw(10) << entry.calls << setprecision(3) << setw(10) << entry.ms
+				<< setprecision(0) << setw(12) << entry.ms * 1e6 / entry.calls;
+			if (frames > 0 && entry.frameCalls)
+				out << setprecision(1) << setw(10) << double(entry.frameCalls) / frames
+					<< setprecision(3) << setw(9) << entry.frameMs / frames;
+			out << endl;
+		}
+		out.unsetf(ios::floatfield);
+		out << setprecision(6);
+	}
+
+	// by the wrappers
+	void record(int call, double ms)
+	{
+		Entry &entry = entries[call];
+		entry.calls++;
+		entry.ms += ms;
+		if (inFrame) {
+			entry.frameCalls++;
+			entry.frameMs += ms;
+		}
+	}
+
+	bool logging() const { return log.is_open(); }
+
+	template <class... Args>
+	void write(int call, Args... args)
+	{
+		log << name(call) << '(';
+		bool first = true;
+		int unused[] = { 0, (put(first, args), 0)... };
+		(void)unused;
+		(void)first;
+		log << ")\n";
+		logged++;
+	}
+
+private:
+	bool inFrame, armed;
+	string logPath;
+	ofstream log;
+	size_t logged;
+
+	template <int Call, class R, class... Args>
+	struct Hook {
+		static R (APIENTRYP driver)(Args...);
+
+		static R APIENTRY call(Args... args)
+		{
+			GlCalls &calls = glCalls();
+			if (calls.logging())
+				calls.write(Call, args...);
+			Timer timer(calls, Call);
+			return driver(args...);
+		}
+	};
+
+	// records the call when the wrapper returns, whatever it returns
+	struct Timer {
+		GlCalls &calls;
+		int call;
+		chrono::high_resolution_clock::time_point start;
+
+		Timer(GlCalls &calls, int call) : calls(calls), call(call), start(chrono::high_resolution_clock::now()) {}
+
+		~Timer()
+		{
+			calls.record(call, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+		}
+	};
+
+	template <int Call, class R, class... Args>
+	static void hook(R (APIENTRYP &pointer)(Args...))
+	{
+		// not loaded by this context, or wrapped already
+		if (!pointer || pointer == &Hook<Call, R, Args...>::call)
+			return;
+		Hook<Call, R, Args...>::driver = pointer;
+		pointer = &Hook<Call, R, Args...>::call;
+	}
+
+	// an argument as the log shows it: strings quoted, pointers in hex, bytes as numbers
+	void put(bool &first, const char *text)
+	{
+		log << (first ? "" : ", ");
+		first = false;
+		if (text)
+			log << '"' << text << '"';
+		else
+			log << "NULL";
+	}
+
+	template <class T>
+	void put(bool &first, T value)
+	{
+		log << (first ? "" : ", ") << +value;
+		first = false;
+	}
+};
+
+template <int Call, class R, class... Args>
+R (APIENTRYP GlCalls::Hook<Call, R, Args...>::driver)(Args...) = NULL;
+
+inline GlCalls &glCalls()
+{
+	static GlCalls instance;
+	return instance;
+}
+
+#define GL_CALLS_INSTALL() glCalls().install()
+#define GL_CALLS_BEGIN_FRAME() glCalls().beginFrame()
+#define GL_CALLS_END_FRAME() glCalls().endFrame()
+#define GL_CALLS_CAPTURE(path) glCalls().capture(path)
+#define GL_CALLS_REPORT(out) glCalls().report(out)
+#else
+#define GL_CALLS_INSTALL()
+#define GL_CALLS_BEGIN_FRAME()
+#define GL_CALLS_END_FRAME()
+#define GL_CALLS_CAPTURE(path)
+#define GL_CALLS_REPORT(out)
+#endif
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <glad/glad.h>
+
+using namespace std;
+
+/*
+	GPU time of a stretch of commands, from a ring of GL_TIME_ELAPSED queries.
+	A result is only read once the GPU has it, normally a frame or two after
+	it was issued, so timing never stalls the pipeline; when every query of
+	the ring is still pending the interval is skipped instead of waited for.
+	Elapsed time queries cannot nest, only one timer may be running at once.
+*/
+class GpuTimer {
+public:
+	static const int QUERIES = 4;
+
+	double lastMs;		// the latest finished interval, -1 before the first
+	int skipped;		// intervals not measured because the ring was full
+
+	GpuTimer() : lastMs(-1.0), skipped(0), ready(false), running(false), fresh(false), head(0), pending(0) {}
+
+	GpuTimer(const GpuTimer &) = delete;
+	GpuTimer &operator=(const GpuTimer &) = delete;
+
+	~GpuTimer()
+	{
+		release();
+	}
+
+	// deletes the queries, a timer owned by a global has to be released while the context still exists
+	void release()
+	{
+		if (ready)
+			glDeleteQueries(QUERIES, queries);
+		ready = running = fresh = false;
+		head = pending = 0;
+	}
+
+	void begin()
+	{
+		if (!ready) {
+			glGenQueries(QUERIES, queries);
+			ready = true;
+		}
+		collect();
+		if (pending == QUERIES) {
+			skipped++;
+			return;
+		}
+		glBeginQuery(GL_TIME_ELAPSED, queries[head]);
+		running = true;
+	}
+
+	void end()
+	{
+		if (!running)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		running = false;
+		head = (head + 1) % QUERIES;
+		pending++;
+	}
+
+	// collects the finished intervals without waiting, returns whether lastMs is new since the last poll
+	bool poll()
+	{
+		collect();
+		bool updated = fresh;
+		fresh = false;
+		return updated;
+	}
+
+private:
+	bool ready, running;
+	bool fresh;		// lastMs has not been polled yet
+	unsigned int queries[QUERIES];
+	int head;			// next query to issue
+	int pending;		// issued and not read yet, they end at head
+
+	void collect()
+	{
+		while (pending > 0) {
+			unsigned int query = queries[(head - pending + QUERIES) % QUERIES];
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			lastMs = nanoseconds / 1e6;
+			pending--;
+			fresh = true;
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,220 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <glad/glad.h>
+
+#include "memtrack.h"
+
+#include <vector>
+#include <iostream>
+
+/*
+	GL context without a window, for batch jobs on machines without a display.
+	Pick the backend at compile time:
+		-DHEADLESS_EGL      surfaceless EGL (Mesa's surfaceless platform, or any
+		                    display supporting EGL_KHR_surfaceless_context), link -lEGL
+		-DHEADLESS_OSMESA   OSMesa software rendering (llvmpipe), link -lOSMesa
+	Either way nothing is drawn to a surface; OffscreenTarget gives the frame
+	buffer the scene is rendered into and read back from.
+*/
+#if defined(HEADLESS_EGL)
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+#elif defined(HEADLESS_OSMESA)
+#include <GL/osmesa.h>
+#endif
+
+using namespace std;
+
+class HeadlessContext {
+public:
+	HeadlessContext() : current(false)
+	{
+#if defined(HEADLESS_EGL)
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#elif defined(HEADLESS_OSMESA)
+		context = NULL;
+#endif
+	}
+
+	HeadlessContext(const HeadlessContext &) = delete;
+	HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+	~HeadlessContext() { destroy(); }
+
+	static bool available()
+	{
+#if defined(HEADLESS_EGL) || defined(HEADLESS_OSMESA)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	// creates a 3.3 core context and makes it current
+	bool create(int width, int height)
+	{
+		// only OSMesa renders into a buffer of the size
+		(void)width;
+		(void)height;
+#if defined(HEADLESS_EGL)
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay)
+			display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		EGLint major, minor;
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			cout << "ERROR::HEADLESS:: no EGL display" << endl;
+			return false;
+		}
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			cout << "ERROR::HEADLESS:: EGL has no desktop OpenGL" << endl;
+			return false;
+		}
+
+		// the surface type defaults to windows, which the surfaceless platform has no configs for
+		const EGLint configAttribs[] = { EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE };
+		EGLConfig config;
+		EGLint count = 0;
+		if (!eglChooseConfig(display, configAttribs, &config, 1, &count) || count == 0) {
+			cout << "ERROR::HEADLESS:: no EGL config" << endl;
+			return false;
+		}
+		const EGLint contextAttribs[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 3,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttribs);
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			cout << "ERROR::HEADLESS:: could not make a surfaceless 3.3 core context current" << endl;
+			return false;
+		}
+		current = true;
+		return true;
+#elif defined(HEADLESS_OSMESA)
+		const int attribs[] = {
+			OSMESA_FORMAT, OSMESA_RGBA,
+			OSMESA_DEPTH_BITS, 24,
+			OSMESA_PROFILE, OSMESA_CORE_PROFILE,
+			OSMESA_CONTEXT_MAJOR_VERSION, 3,
+			OSMESA_CONTEXT_MINOR_VERSION, 3,
+			0
+		};
+		context = OSMesaCreateContextAttribs(attribs, NULL);
+		// OSMesa wants a colour buffer to be current, the scene goes to an FBO anyway
+		buffer.resize((size_t)width * height * 4);
+		if (!context || !OSMesaMakeCurrent(context, &buffer[0], GL_UNSIGNED_BYTE, width, height)) {
+			cout << "ERROR::HEADLESS:: could not create a 3.3 core OSMesa context" << endl;
+			return false;
+		}
+		current = true;
+		return true;
+#else
+		cout << "ERROR::HEADLESS:: built without a headless backend (HEADLESS_EGL or HEADLESS_OSMESA)" << endl;
+		return false;
+#endif
+	}
+
+	// proc address function for gladLoadGLLoader and TransformRing::setup
+	GLADloadproc loader() const
+	{
+#if defined(HEADLESS_EGL)
+		return (GLADloadproc)eglGetProcAddress;
+#elif defined(HEADLESS_OSMESA)
+		return (GLADloadproc)OSMesaGetProcAddress;
+#else
+		return NULL;
+#endif
+	}
+
+	void destroy()
+	{
+#if defined(HEADLESS_EGL)
+		if (display != EGL_NO_DISPLAY) {
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			if (context != EGL_NO_CONTEXT)
+				eglDestroyContext(display, context);
+			eglTerminate(display);
+		}
+		display = EGL_NO_DISPLAY;
+		context = EGL_NO_CONTEXT;
+#elif defined(HEADLESS_OSMESA)
+		if (context)
+			OSMesaDestroyContext(context);
+		context = NULL;
+#endif
+		current = false;
+	}
+
+private:
+	bool current;
+#if defined(HEADLESS_EGL)
+	EGLDisplay display;
+	EGLContext context;
+#elif defined(HEADLESS_OSMESA)
+	OSMesaContext context;
+	vector<unsigned char> buffer;
+#endif
+};
+
+// colour and depth renderbuffers the size of the stereo pair
+class OffscreenTarget {
+public:
+	int width, height;
+
+	OffscreenTarget(int width, int height) : width(width), height(height), memory("offscreen target")
+	{
+		glGenRenderbuffers(1, &color);
+		glBindRenderbuffer(GL_RENDERBUFFER, color);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glGenRenderbuffers(1, &depth);
+		glBindRenderbuffer(GL_RENDERBUFFER, depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depth);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "ERROR::HEADLESS:: offscreen framebuffer is not complete" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		memory.set(MEM_GPU_TARGET, textureBytes(width, height, 4 + 4, false));
+	}
+
+	OffscreenTarget(const OffscreenTarget &) = delete;
+	OffscreenTarget &operator=(const OffscreenTarget &) = delete;
+
+	~OffscreenTarget()
+	{
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteRenderbuffers(1, &color);
+		glDeleteRenderbuffers(1, &depth);
+	}
+
+	void bind() const { glBindFramebuffer(GL_FRAMEBUFFER, fbo); }
+	unsigned int framebuffer() const { return fbo; }
+
+	// RGBA rows bottom-up, blocks until the frame is done
+	void read(vector<unsigned char> &pixels) const
+	{
+		pixels.resize((size_t)width * height * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	}
+
+private:
+	unsigned int fbo, color, depth;
+	MemoryAccount memory;
+};
+
+#endif
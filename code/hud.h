@@ -0,0 +1,163 @@
+#ifndef HUD_H
+#define HUD_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Text overlay in a corner of a viewport, for the render statistics.
+	The font is a built in 5x7 bitmap of the printable ASCII range up to
+	'_' (lower case is drawn as upper case), packed into one R8 texture of
+	6x8 cells on first use. draw() builds a quad per character plus a dark
+	backdrop into a streamed vertex buffer and blends it over what is there,
+	without depth test; it is only meant for a few short lines.
+*/
+class TextOverlay {
+public:
+	static const int GLYPH_WIDTH = 5, GLYPH_HEIGHT = 7;
+	static const int CELL_WIDTH = 6, CELL_HEIGHT = 8;		// glyph plus spacing
+	static const int FIRST = 32, COUNT = 64;				// ' ' to '_'
+
+	int scale;		// screen pixels per font pixel
+
+	TextOverlay() : scale(2), texture(0), vao(0), vbo(0) {}
+
+	TextOverlay(const TextOverlay &) = delete;
+	TextOverlay &operator=(const TextOverlay &) = delete;
+
+	~TextOverlay()
+	{
+		if (texture)
+			glDeleteTextures(1, &texture);
+		if (vbo)
+			glDeleteBuffers(1, &vbo);
+		if (vao)
+			glDeleteVertexArrays(1, &vao);
+	}
+
+	// lines from the top left corner of viewport (x, y, width, height) of the bound framebuffer
+	void draw(Shader &shader, const vector<string> &lines, const vec4 &viewport)
+	{
+		if (!texture)
+			setup();
+
+		vertices.clear();
+		size_t longest = 0;
+		for (unsigned int i = 0; i < lines.size(); i++)
+			longest = std::max(longest, lines[i].size());
+		float margin = 4.0f * scale;
+		float width = longest * CELL_WIDTH * scale + 2 * margin, height = lines.size() * CELL_HEIGHT * scale + 2 * margin;
+		// the backdrop samples no glyph
+		quad(vec2(0.0f, viewport.w - height), vec2(width, viewport.w), vec2(-1.0f), vec2(-1.0f));
+		for (unsigned int row = 0; row < lines.size(); row++) {
+			float top = viewport.w - margin - row * CELL_HEIGHT * scale;
+			for (unsigned int column = 0; column < lines[row].size(); column++) {
+				int glyph = toupper((unsigned char)lines[row][column]) - FIRST;
+				if (glyph <= 0 || glyph >= COUNT)
+					continue;
+				vec2 low(margin + column * CELL_WIDTH * scale, top - CELL_HEIGHT * scale);
+				vec2 cell(float(glyph * CELL_WIDTH), 0.0f);
+				quad(low, low + vec2(CELL_WIDTH, CELL_HEIGHT) * float(scale), cell, cell + vec2(CELL_WIDTH, CELL_HEIGHT));
+			}
+		}
+
+		glViewport((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+		glScissor((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+		shader.use();
+		shader.setVec2("viewportSize", viewport.z, viewport.w);
+		shader.setVec2("atlasSize", float(COUNT * CELL_WIDTH), float(CELL_HEIGHT));
+		shader.setInt("font", 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(vec4), &vertices[0], GL_STREAM_DRAW);
+		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)vertices.size());
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glBindVertexArray(0);
+
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+	}
+
+private:
+	unsigned int texture, vao, vbo;
+	vector<vec4> vertices;		// (pixel position, atlas texel)
+
+	void quad(vec2 low, vec2 high, vec2 texelLow, vec2 texelHigh)
+	{
+		// the atlas rows go top down like the font, the screen bottom up
+		vec4 corners[4] = {
+			vec4(low.x, low.y, texelLow.x, texelHigh.y), vec4(high.x, low.y, texelHigh.x, texelHigh.y),
+			vec4(high.x, high.y, texelHigh.x, texelLow.y), vec4(low.x, high.y, texelLow.x, texelLow.y)
+		};
+		int order[6] = { 0, 1, 2, 0, 2, 3 };
+		for (int i = 0; i < 6; i++)
+			vertices.push_back(corners[order[i]]);
+	}
+
+	void setup()
+	{
+		// one row per font pixel row, a bit per pixel from the left
+		static const unsigned char glyphs[COUNT][GLYPH_HEIGHT] = {
+			{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x04, 0x04, 0x04, 0x04, 0x04, 0x00, 0x04}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// space ! " #
+			{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// $ % & '
+			{0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}, {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// ( ) * +
+			{0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}, {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00},	// , - . /
+			{0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e},	// 0 1 2 3
+			{0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08},	// 4 5 6 7
+			{0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// 8 9 : ;
+			{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x1f, 0x00, 0x1f, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// < = > ?
+			{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}, {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e},	// @ A B C
+			{0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}, {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f},	// D E F G
+			{0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}, {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}, {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}, {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11},	// H I J K
+			{0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}, {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}, {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}, {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e},	// L M N O
+			{0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}, {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}, {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}, {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e},	// P Q R S
+			{0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}, {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}, {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a},	// T U V W
+			{0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}, {0x11, 0x11, 0x0a, 0x04, 0x04, 0x04, 0x04}, {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// X Y Z [
+			{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00},	// \\ ] ^ _
+		};
+		vector<unsigned char> atlas(COUNT * CELL_WIDTH * CELL_HEIGHT, 0);
+		for (int g = 0; g < COUNT; g++)
+			for (int y = 0; y < GLYPH_HEIGHT; y++)
+				for (int x = 0; x < GLYPH_WIDTH; x++)
+					if (glyphs[g][y] & (1 << (GLYPH_WIDTH - 1 - x)))
+						atlas[y * COUNT * CELL_WIDTH + g * CELL_WIDTH + x] = 255;
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, COUNT * CELL_WIDTH, CELL_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, &atlas[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(vec4), (void*)0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+};
+
+#endif
@@ -0,0 +1,232 @@
+#ifndef IMAGEWRITE_H
+#define IMAGEWRITE_H
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+
+using namespace std;
+
+/*
+	Minimal PNG encoder for the offscreen modes.
+	RGBA pixels as read back from GL go in, an 8 bit RGB PNG comes out. The
+	zlib stream uses stored (uncompressed) deflate blocks: files are larger
+	than with real compression, but encoding is a plain copy plus CRC and
+	Adler checksums, far cheaper than rendering the frame.
+*/
+namespace imagewrite_detail {
+
+	struct CrcTable {
+		uint32_t entries[256];
+
+		CrcTable()
+		{
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++)
+					c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+				entries[n] = c;
+			}
+		}
+	};
+
+	inline uint32_t crc32(const unsigned char *data, size_t size, uint32_t crc = 0)
+	{
+		// the encoder workers call this concurrently, a function-local static is built exactly once
+		static const CrcTable table;
+		crc = ~crc;
+		for (size_t i = 0; i < size; i++)
+			crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	inline void put32(vector<unsigned char> &out, uint32_t value)
+	{
+		out.push_back((unsigned char)(value >> 24));
+		out.push_back((unsigned char)(value >> 16));
+		out.push_back((unsigned char)(value >> 8));
+		out.push_back((unsigned char)value);
+	}
+
+	inline void chunk(vector<unsigned char> &out, const char *type, const vector<unsigned char> &data)
+	{
+		put32(out, (uint32_t)data.size());
+		size_t start = out.size();
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data.begin(), data.end());
+		put32(out, crc32(&out[start], out.size() - start));
+	}
+}
+
+// flipY turns GL's bottom-up rows into the top-down order of the file
+inline vector<unsigned char> encodePNG(int width, int height, const unsigned char *rgba, bool flipY = true)
+{
+	using namespace imagewrite_detail;
+
+	// filter type 0 (none) in front of every row
+	size_t rowBytes = (size_t)width * 3 + 1;
+	vector<unsigned char> raw(rowBytes * height);
+	for (int y = 0; y < height; y++) {
+		const unsigned char *src = rgba + (size_t)(flipY ? height - 1 - y : y) * width * 4;
+		unsigned char *dst = &raw[y * rowBytes];
+		*dst++ = 0;
+		for (int x = 0; x < width; x++, src += 4) {
+			*dst++ = src[0]; *dst++ = src[1]; *dst++ = src[2];
+		}
+	}
+
+	// zlib header, stored blocks of at most 65535 bytes, adler32
+	vector<unsigned char> z;
+	z.reserve(raw.size() + raw.size() / 65535 * 5 + 16);
+	z.push_back(0x78); z.push_back(0x01);
+	size_t pos = 0;
+	do {
+		size_t len = std::min<size_t>(raw.size() - pos, 65535);
+		bool last = pos + len == raw.size();
+		z.push_back(last ? 1 : 0);
+		z.push_back((unsigned char)len); z.push_back((unsigned char)(len >> 8));
+		z.push_back((unsigned char)~len); z.push_back((unsigned char)(~len >> 8));
+		z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+		pos += len;
+	} while (pos < raw.size());
+	uint32_t a = 1, b = 0;
+	for (size_t i = 0; i < raw.size(); i++) {
+		a += raw[i];
+		if (a >= 65521) a -= 65521;
+		b += a;
+		if (b >= 65521) b -= 65521;
+	}
+	put32(z, (b << 16) | a);
+
+	vector<unsigned char> png;
+	png.reserve(z.size() + 64);
+	const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	png.insert(png.end(), signature, signature + 8);
+
+	vector<unsigned char> header;
+	put32(header, width);
+	put32(header, height);
+	header.push_back(8);	// bit depth
+	header.push_back(2);	// colour type RGB
+	header.push_back(0); header.push_back(0); header.push_back(0);
+	chunk(png, "IHDR", header);
+	chunk(png, "IDAT", z);
+	chunk(png, "IEND", vector<unsigned char>());
+	return png;
+}
+
+inline bool writeFile(const string &path, const vector<unsigned char> &data)
+{
+	FILE *file = fopen(path.c_str(), "wb");
+	if (!file)
+		return false;
+	bool ok = fwrite(&data[0], 1, data.size(), file) == data.size();
+	return fclose(file) == 0 && ok;
+}
+
+inline bool writePNG(const string &path, int width, int height, const unsigned char *rgba, bool flipY = true)
+{
+	return writeFile(path, encodePNG(width, height, rgba, flipY));
+}
+
+/*
+	Encodes and writes PNGs on worker threads while the caller renders on.
+	push() only blocks when maxQueued images are already waiting, which bounds
+	the memory when the disk or the encoders fall behind the GPU.
+*/
+class ImageWriteQueue {
+public:
+	atomic<int> written, failed;
+	int blocked;		// pushes that had to wait for a free place
+
+	ImageWriteQueue(unsigned int threads = thread::hardware_concurrency(), size_t maxQueued = 16)
+		: written(0), failed(0), blocked(0), maxQueued(maxQueued), stopping(false)
+	{
+		if (threads < 1)
+			threads = 1;
+		for (unsigned int i = 0; i < threads; i++)
+			workers.push_back(thread(&ImageWriteQueue::workerLoop, this));
+	}
+
+	ImageWriteQueue(const ImageWriteQueue &) = delete;
+	ImageWriteQueue &operator=(const ImageWriteQueue &) = delete;
+
+	~ImageWriteQueue()
+	{
+		finish();
+	}
+
+	// takes over the pixels (RGBA, rows bottom-up)
+	void push(const string &path, int width, int height, vector<unsigned char> &&rgba)
+	{
+		unique_lock<mutex> lock(mtx);
+		if (jobs.size() >= maxQueued) {
+			blocked++;
+			space.wait(lock, [this] { return jobs.size() < maxQueued; });
+		}
+		Job job;
+		job.path = path;
+		job.width = width;
+		job.height = height;
+		job.rgba = std::move(rgba);
+		jobs.push_back(std::move(job));
+		lock.unlock();
+		work.notify_one();
+	}
+
+	// writes everything queued and stops the workers
+	void finish()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		work.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+	}
+
+private:
+	struct Job {
+		string path;
+		int width, height;
+		vector<unsigned char> rgba;
+	};
+
+	vector<thread> workers;
+	deque<Job> jobs;
+	size_t maxQueued;
+	bool stopping;
+	mutex mtx;
+	condition_variable work, space;
+
+	void workerLoop()
+	{
+		for (;;) {
+			Job job;
+			{
+				unique_lock<mutex> lock(mtx);
+				work.wait(lock, [this] { return stopping || !jobs.empty(); });
+				if (jobs.empty())
+					return;
+				job = std::move(jobs.front());
+				jobs.pop_front();
+			}
+			space.notify_one();
+			if (writePNG(job.path, job.width, job.height, &job.rgba[0]))
+				written++;
+			else
+				failed++;
+		}
+	}
+};
+
+#endif
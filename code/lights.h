@@ -0,0 +1,278 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "threadpool.h"
+#include "memtrack.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define LIGHTS_SSE 1
+#endif
+
+using namespace std;
+using namespace glm;
+
+struct PointLight {
+	vec3 position;
+	vec3 color;
+	float radius;		// no contribution beyond this distance
+};
+
+/*
+	Clustered forward lighting.
+	The view frustum is cut into CLUSTER_X * CLUSTER_Y screen tiles and
+	CLUSTER_Z exponential depth slices. Every eye, the lights are binned into
+	the clusters they touch on the worker threads, and the per cluster lists
+	go to the shader through texture buffers:
+		lightData     RGBA32F, two texels per light (position, radius) (color, 0)
+		clusterData   RG32UI,  (first index, count) per cluster
+		lightIndices  R32UI,   concatenated light lists
+	so a fragment only loops over the lights of its own cluster.
+*/
+class ClusteredLights {
+public:
+	static const int CLUSTER_X = 16;
+	static const int CLUSTER_Y = 9;
+	static const int CLUSTER_Z = 24;
+	static const int CLUSTER_COUNT = CLUSTER_X * CLUSTER_Y * CLUSTER_Z;
+	static const int FIRST_UNIT = 8;	// texture units above the material textures
+
+	vector<PointLight> lights;
+
+	ClusteredLights() : ready(false), memory("light clusters") {}
+
+	// bins the lights for one eye; near/far must be those of the projection
+	void update(const mat4 &view, const mat4 &projection, float nearPlane, float farPlane)
+	{
+		if (!ready)
+			setupBuffers();
+		if (projection != clusterProjection || nearPlane != zNear || farPlane != zFar) {
+			zNear = nearPlane;
+			zFar = farPlane;
+			clusterProjection = projection;
+			buildClusterBounds();
+		}
+
+		// view space light spheres, structure-of-arrays and padded for the SIMD test
+		size_t count = lights.size();
+		size_t padded = (count + 3) & ~size_t(3);
+		lx.assign(padded, 0.0f); ly.assign(padded, 0.0f); lz.assign(padded, 0.0f); lr.assign(padded, -1.0f);
+		for (size_t i = 0; i < count; i++) {
+			vec3 p = vec3(view * vec4(lights[i].position, 1.0f));
+			lx[i] = p.x; ly[i] = p.y; lz[i] = p.z; lr[i] = lights[i].radius;
+		}
+
+		// one job per depth slice, each writes only its own clusters
+		sliceLists.resize(CLUSTER_Z);
+		workerPool().parallelFor(CLUSTER_Z, [&](int slice) { binSlice(slice); });
+
+		// offsets of every cluster in the concatenated index list
+		indices.clear();
+		for (int slice = 0; slice < CLUSTER_Z; slice++) {
+			SliceList &list = sliceLists[slice];
+			for (int c = 0; c < CLUSTER_X * CLUSTER_Y; c++) {
+				int cluster = slice * CLUSTER_X * CLUSTER_Y + c;
+				clusters[2 * cluster] = (unsigned int)indices.size() + list.offset[c];
+				clusters[2 * cluster + 1] = list.count[c];
+			}
+			indices.insert(indices.end(), list.indices.begin(), list.indices.end());
+		}
+
+		upload();
+	}
+
+	// binds the buffers and sets the cluster uniforms; viewport is the eye's (x, y, width, height)
+	void bind(Shader &shader, const vec4 &viewport) const
+	{
+		unsigned int textures[3] = { lightTexture, clusterTexture, indexTexture };
+		const char *names[3] = { "lightData", "clusterData", "lightIndices" };
+		for (int i = 0; i < 3; i++) {
+			glActiveTexture(GL_TEXTURE0 + FIRST_UNIT + i);
+			glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+			shader.setInt(names[i], FIRST_UNIT + i);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		renderCounters().textureBinds += 3;
+
+		shader.setVec3("clusterGrid", (float)CLUSTER_X, (float)CLUSTER_Y, (float)CLUSTER_Z);
+		shader.setVec2("clusterDepth", zNear, std::log(zFar / zNear));
+		shader.setVec4("viewport", viewport);
+	}
+
+	// deletes the buffers; the lights are global, this has to happen while the context still exists
+	void release()
+	{
+		if (!ready)
+			return;
+		unsigned int textures[3] = { lightTexture, clusterTexture, indexTexture };
+		unsigned int buffers[3] = { lightBuffer, clusterBuffer, indexBuffer };
+		glDeleteTextures(3, textures);
+		glDeleteBuffers(3, buffers);
+		memory.clear();
+		ready = false;
+	}
+
+private:
+	struct SliceList {
+		vector<unsigned int> indices;
+		unsigned int offset[CLUSTER_X * CLUSTER_Y];
+		unsigned int count[CLUSTER_X * CLUSTER_Y];
+		vector<unsigned int> candidates;
+		vector<float> cx, cy, cz, cr;
+	};
+
+	bool ready;
+	unsigned int lightBuffer, clusterBuffer, indexBuffer;
+	unsigned int lightTexture, clusterTexture, indexTexture;
+	MemoryAccount memory;
+
+	mat4 clusterProjection;
+	float zNear = 0, zFar = 0;
+	vector<vec3> boundsMin, boundsMax;		// view space box of every cluster
+
+	vector<float> lx, ly, lz, lr;
+	vector<SliceList> sliceLists;
+	vector<unsigned int> clusters = vector<unsigned int>(2 * CLUSTER_COUNT);
+	vector<unsigned int> indices;
+	vector<vec4> lightTexels;
+
+	void setupBuffers()
+	{
+		glGenBuffers(1, &lightBuffer);
+		glGenBuffers(1, &clusterBuffer);
+		glGenBuffers(1, &indexBuffer);
+		glGenTextures(1, &lightTexture);
+		glGenTextures(1, &clusterTexture);
+		glGenTextures(1, &indexTexture);
+		ready = true;
+	}
+
+	float sliceDepth(int slice) const
+	{
+		return zNear * std::pow(zFar / zNear, float(slice) / CLUSTER_Z);
+	}
+
+	void buildClusterBounds()
+	{
+		mat4 inverseProjection = inverse(clusterProjection);
+		boundsMin.resize(CLUSTER_COUNT);
+		boundsMax.resize(CLUSTER_COUNT);
+		for (int z = 0; z < CLUSTER_Z; z++) {
+			float d0 = sliceDepth(z), d1 = sliceDepth(z + 1);
+			for (int y = 0; y < CLUSTER_Y; y++) {
+				for (int x = 0; x < CLUSTER_X; x++) {
+					vec3 lo(FLT_MAX), hi(-FLT_MAX);
+					for (int corner = 0; corner < 4; corner++) {
+						float ndcX = -1.0f + 2.0f * (x + (corner & 1)) / CLUSTER_X;
+						float ndcY = -1.0f + 2.0f * (y + (corner >> 1)) / CLUSTER_Y;
+						vec4 p = inverseProjection * vec4(ndcX, ndcY, -1.0f, 1.0f);
+						vec3 dir = vec3(p) / p.w;
+						// the points of this ray at the slice's near and far depth
+						vec3 a = dir * (d0 / -dir.z), b = dir * (d1 / -dir.z);
+						lo = glm::min(lo, glm::min(a, b));
+						hi = glm::max(hi, glm::max(a, b));
+					}
+					int cluster = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+					boundsMin[cluster] = lo;
+					boundsMax[cluster] = hi;
+				}
+			}
+		}
+	}
+
+	void binSlice(int slice)
+	{
+		SliceList &list = sliceLists[slice];
+		list.indices.clear();
+		list.candidates.clear();
+		list.cx.clear(); list.cy.clear(); list.cz.clear(); list.cr.clear();
+
+		// lights reaching this depth range at all
+		float d0 = sliceDepth(slice), d1 = sliceDepth(slice + 1);
+		for (size_t i = 0; i < lights.size(); i++) {
+			float depth = -lz[i];
+			if (depth + lr[i] < d0 || depth - lr[i] > d1)
+				continue;
+			list.candidates.push_back((unsigned int)i);
+			list.cx.push_back(lx[i]); list.cy.push_back(ly[i]); list.cz.push_back(lz[i]); list.cr.push_back(lr[i]);
+		}
+		while (list.cx.size() % 4) {
+			list.cx.push_back(0.0f); list.cy.push_back(0.0f); list.cz.push_back(0.0f); list.cr.push_back(-1.0f);
+		}
+
+		for (int c = 0; c < CLUSTER_X * CLUSTER_Y; c++) {
+			int cluster = slice * CLUSTER_X * CLUSTER_Y + c;
+			const vec3 &lo = boundsMin[cluster], &hi = boundsMax[cluster];
+			list.offset[c] = (unsigned int)list.indices.size();
+
+			// sphere against box: squared distance from the centre to the box <= r^2
+#ifdef LIGHTS_SSE
+			__m128 minX = _mm_set1_ps(lo.x), minY = _mm_set1_ps(lo.y), minZ = _mm_set1_ps(lo.z);
+			__m128 maxX = _mm_set1_ps(hi.x), maxY = _mm_set1_ps(hi.y), maxZ = _mm_set1_ps(hi.z);
+			for (size_t i = 0; i < list.cx.size(); i += 4) {
+				__m128 x = _mm_loadu_ps(&list.cx[i]), y = _mm_loadu_ps(&list.cy[i]), z = _mm_loadu_ps(&list.cz[i]);
+				__m128 r = _mm_loadu_ps(&list.cr[i]);
+				__m128 dx = _mm_sub_ps(x, _mm_min_ps(_mm_max_ps(x, minX), maxX));
+				__m128 dy = _mm_sub_ps(y, _mm_min_ps(_mm_max_ps(y, minY), maxY));
+				__m128 dz = _mm_sub_ps(z, _mm_min_ps(_mm_max_ps(z, minZ), maxZ));
+				__m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+				__m128 hit = _mm_and_ps(_mm_cmple_ps(dist, _mm_mul_ps(r, r)), _mm_cmpge_ps(r, _mm_setzero_ps()));
+				int mask = _mm_movemask_ps(hit);
+				for (int k = 0; mask; k++, mask >>= 1) {
+					if (mask & 1)
+						list.indices.push_back(list.candidates[i + k]);
+				}
+			}
+#else
+			for (size_t i = 0; i < list.candidates.size(); i++) {
+				vec3 p(list.cx[i], list.cy[i], list.cz[i]);
+				vec3 d = p - glm::clamp(p, lo, hi);
+				if (dot(d, d) <= list.cr[i] * list.cr[i])
+					list.indices.push_back(list.candidates[i]);
+			}
+#endif
+			list.count[c] = (unsigned int)list.indices.size() - list.offset[c];
+		}
+	}
+
+	void upload()
+	{
+		// positions stay in world space, the shader lights in world space; the view only drives the binning
+		lightTexels.resize(std::max<size_t>(2 * lights.size(), 1));
+		for (size_t i = 0; i < lights.size(); i++) {
+			lightTexels[2 * i] = vec4(lights[i].position, lights[i].radius);
+			lightTexels[2 * i + 1] = vec4(lights[i].color, 0.0f);
+		}
+		if (indices.empty())
+			indices.push_back(0);
+
+		uploadBuffer(lightBuffer, lightTexture, GL_RGBA32F, lightTexels.size() * sizeof(vec4), &lightTexels[0]);
+		uploadBuffer(clusterBuffer, clusterTexture, GL_RG32UI, clusters.size() * sizeof(unsigned int), &clusters[0]);
+		uploadBuffer(indexBuffer, indexTexture, GL_R32UI, indices.size() * sizeof(unsigned int), &indices[0]);
+		memory.set(MEM_GPU_STREAM, lightTexels.size() * sizeof(vec4) + (clusters.size() + indices.size()) * sizeof(unsigned int));
+	}
+
+	void uploadBuffer(unsigned int buffer, unsigned int texture, GLenum format, size_t bytes, const void *data)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		// orphan the old storage so the other eye's draws are not waited for
+		glBufferData(GL_TEXTURE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+		renderCounters().bytesUploaded += bytes;
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, format, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+};
+
+#endif
@@ -8,8 +8,31 @@
 
 #include "shader.h"
 #include "model.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "lights.h"
+#include "shadow.h"
+#include "transforms.h"
+#include "headless.h"
+#include "imagewrite.h"
+#include "readback.h"
+#include "softraster.h"
+#include "raytrace.h"
+#include "sceneindex.h"
+#include "reproject.h"
+#include "rendertarget.h"
+#include "dynres.h"
+#include "foveation.h"
+#include "profiler.h"
+#include "stats.h"
+#include "hud.h"
+#include "glcalls.h"
+#include "memtrack.h"
 
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
 
 
 using namespace std;
@@ -44,6 +67,14 @@ vec3 ambient(0.3, 0.3, 0.3);
 vec3 diffuse(0.4, 0.4, 0.4);
 const double lightstep = 0.05;
 
+//additional point lights, binned into clusters every eye
+ClusteredLights pointLights;
+vec4 eyeViewport;
+
+//shadow cube of the lamp, rendered again only when the light or a caster near it moves
+ShadowCache shadows;
+bool useShadows = true;
+
 
 
 bool selectMode = false;
@@ -51,7 +82,54 @@ bool choosen = false;
 bool changelight = false;
 bool movelight = false;
 bool firstRenderMouse = true;
+//the object held by the mouse since click_mouse picked it, -1 for none
+int pickedObject = -1;
+
+//dynamic hierarchy over the objects for picking, culling and the lamp range; the lamp is set by SceneResources
+SceneIndex sceneIndex;
+const Model *lampModel = NULL;
+
+//software occlusion culling
+OcclusionCuller occlusion;
+bool occlusionCulling = true;
+
+//distance based level of detail
+bool useLod = true;
+
+//objects that survived culling for the current eye, with their level of detail
+vector<int> visibleObjs;
+vector<int> visibleLods;
+
+//depth pre-pass, the colour pass then shades every pixel once
+bool depthPrepass = false;
+
+//set by every callback that changes what is seen; without it the loop sleeps in glfwWaitEvents
+//and the last swapped frame simply stays on screen
+bool redraw = true;
+
+//model and normal matrices of every object, written once per frame and shared by all passes of both eyes
+TransformRing transforms;
+
+//the right eye warped from the left one instead of rendered, see reproject.h;
+//begin_frame latches it so that both eyes of a frame use the same mode
+int reprojectMode = REPROJECT_OFF;
+int frameReprojectMode = REPROJECT_OFF;
 
+//eyes rendered smaller and stretched when the GPU time of a frame goes over budget
+DynamicResolution dynamicResolution;
+
+//only a rectangle around the fovea at full resolution, the rest of each eye coarser, see foveation.h;
+//the cursor is kept for FOVEA_CURSOR, in window pixels from the top left like glfw gives it
+int foveaMode = FOVEA_OFF;
+float foveaInset = 0.4f, foveaPeriphery = 0.5f;
+vec2 cursorPosition(SCR_WIDTH / 2.0f, SCR_HEIGHT / 2.0f);
+
+//draw calls, binds and uploads of the last frame over the window, see stats.h
+bool showStats = false;
+
+//--window-fallback: without a headless backend the offscreen modes render through a hidden glfw window,
+//which needs a display; off by default so that a build without one reports it instead
+bool windowFallback = false;
 
 //callback_function
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
@@ -59,16 +137,117 @@ void move_mouse(GLFWwindow* window, double xpos, double ypos);
 void click_mouse(GLFWwindow* window, int button, int action, int mods);
 void press_key(GLFWwindow* window, int key, int scancode, int action, int mods);
 void scroll(GLFWwindow* window, double x, double y);
+void refresh_window(GLFWwindow* window);
+void object_moved(int object);
 //rendering function
-void render_scene(Shader modelShader,Model background, Model sky, Model lightModel, mat4 projection, mat4 view);
-void render_light(Shader lightShader, Model lightModel, mat4 projection, mat4 view);
-void render_model(Shader modelShader,Model lightModel, mat4 projection,  mat4 view);
+void render_scene(Shader &modelShader, Model &background, Model &lightModel, mat4 projection, mat4 view);
+void render_sky(Shader &skyShader, Model &sky, mat4 projection, mat4 view);
+void render_light(Shader &lightShader, Model &lightModel, mat4 projection, mat4 view);
+mat4 lamp_transform(vec3 position);
+void render_model(Shader &modelShader, Model &lightModel, mat4 projection,  mat4 view);
+void render_occluders(Model &background, mat4 projection, mat4 view);
+void render_depth(Shader &depthShader, Model &background, mat4 projection, mat4 view);
+void select_visible(mat4 projection, mat4 view);
+void upload_transforms(Model &background);
+
+//shaders and fixed models, shared by the window and the headless mode; needs a current context
+struct SceneResources {
+	Shader modelShader;
+	Shader lightShader;
+	Shader skyShader;
+	Shader depthShader;
+	Shader shadowShader;
+	Shader reprojectShader;
+	Shader holeFillShader;
+	Shader foveateShader;
+	Shader hudShader;
+	Model backgroundModel;
+	Model lightModel;
+	Model sky;
+	StereoReprojector reprojector;
+	TextureTarget eyeTarget;		// an eye at dynamic resolution, before it is stretched
+	FoveatedRenderer foveation;
+	TextOverlay hud;
+
+	SceneResources(string setting_file, GLADloadproc load);
+};
+
+//context of the non-interactive modes, torn down with it on every path out of a mode
+struct OffscreenContext {
+	HeadlessContext headless;
+	GLFWwindow *window;
+	bool glfw;		// glfwInit succeeded, glfwTerminate is owed
+
+	OffscreenContext() : window(NULL), glfw(false) {}
+	~OffscreenContext() { if (glfw) glfwTerminate(); }
+
+	GLADloadproc create();
+};
+void begin_frame(SceneResources &scene);
+void render_eye(SceneResources &scene, int eye, vec4 viewport, bool clear = true, mat4 crop = mat4(1.0f));
+void render_stereo_eye(SceneResources &scene, int eye, unsigned int framebuffer);
+void end_frame();
+void draw_stats_hud(SceneResources &scene, unsigned int framebuffer);
+mat4 eye_projection();
+mat4 eye_view(int eye);
+vec2 fovea_centre();
+int run_headless(string setting_file, string output, int frames);
+int run_path(string setting_file, string path_file, string output_dir);
+int bench_reproject(string setting_file, int frames);
+void set_camera(vec3 eye, float yaw, float up, vec3 eyeDelta);
+void release_globals();
+
+//models of the CPU renderer, loaded with uploadToGL off so no GL context is needed
+struct SoftwareScene {
+	Model backgroundModel;
+	Model lightModel;
+
+	SoftwareScene(string setting_file);
+};
+template <class Renderer> void submit_software_scene(Renderer &renderer, SoftwareScene &scene);
+void render_software(SoftwareRasterizer &raster, SoftwareScene &scene);
+int run_software(string setting_file, string output, int frames);
+int bench_raster(string setting_file, int frames);
+int run_raytrace(string setting_file, string output_prefix, int samples);
 
 //definition reading
 void parsesetting(string setting_file); 
 
-int main()
+int main(int argc, char* argv[])
 {
+	TRACE_THREAD_NAME("main");
+	//--window-fallback may follow any of the offscreen modes
+	for (int i = 1; i < argc; i++) {
+		if (string(argv[i]) == "--window-fallback") {
+			windowFallback = true;
+			for (int j = i; j + 1 < argc; j++)
+				argv[j] = argv[j + 1];
+			argc--;
+			break;
+		}
+	}
+	if (argc > 1 && string(argv[1]) == "--bench-cull") {
+		benchmarkCulling();
+		return 0;
+	}
+	//main --headless setting_file [output.png] [frames]
+	if (argc > 2 && string(argv[1]) == "--headless")
+		return run_headless(argv[2], argc > 3 ? argv[3] : "stereo.png", argc > 4 ? max(atoi(argv[4]), 1) : 1);
+	//main --path setting_file path_file [output_dir]
+	if (argc > 3 && string(argv[1]) == "--path")
+		return run_path(argv[2], argv[3], argc > 4 ? argv[4] : ".");
+	//main --bench-reproject setting_file [frames]
+	if (argc > 2 && string(argv[1]) == "--bench-reproject")
+		return bench_reproject(argv[2], argc > 3 ? max(atoi(argv[3]), 1) : 20);
+	//main --software setting_file [output.png] [frames], no GL driver needed
+	if (argc > 2 && string(argv[1]) == "--software")
+		return run_software(argv[2], argc > 3 ? argv[3] : "stereo.png", argc > 4 ? max(atoi(argv[4]), 1) : 1);
+	//main --bench-raster setting_file [frames]
+	if (argc > 2 && string(argv[1]) == "--bench-raster")
+		return bench_raster(argv[2], argc > 3 ? max(atoi(argv[3]), 1) : 20);
+	//main --raytrace setting_file [output_prefix] [samples], writes output_prefix_left.png and _right.png
+	if (argc > 2 && string(argv[1]) == "--raytrace")
+		return run_raytrace(argv[2], argc > 3 ? argv[3] : "reference", argc > 4 ? max(atoi(argv[4]), 1) : 2);
 
 	//instructions
 		cout << "* instruction:\n";
@@ -81,6 +260,26 @@ int main()
 		cout << "* with light control open, scroll the mouse can change the value of diffuse/ambient of the light\n";
 		cout << "* mouse press on the object to drag them to somewhere you like.\n";
 		cout << "* while a object is selected with the key pressed, you can rotate it with button b.\n";
+		cout << "* o for turning the occlusion culling on/off\n";
+		cout << "* l for turning the level of detail on/off\n";
+		cout << "* z for turning the depth pre-pass on/off\n";
+		cout << "* h for turning the lamp shadows on/off\n";
+		cout << "* r for warping the right eye from the left one: off, holes rendered again, holes filled\n";
+		cout << "* g for turning the dynamic resolution on/off (frame_budget in the setting file)\n";
+		cout << "* f for the full resolution part of each eye: off, screen centre, cursor (foveation in the setting file)\n";
+		cout << "* v for showing the draw calls, binds and uploads of every frame\n";
+		cout << "* c for recording them to stats.csv on/off (stats_csv in the setting file)\n";
+		cout << "* x for printing the memory held by every model and render target (memory_budget in the setting file)\n";
+#ifdef PROFILER
+		cout << "* p for printing the CPU/GPU time of every pass\n";
+#endif
+#ifdef TRACING
+		cout << "* t for writing the timeline so far to trace.json (also written on exit)\n";
+#endif
+#ifdef GL_CALLS
+		cout << "* j for printing the calls and CPU time of every GL function so far\n";
+		cout << "* u for writing every GL call of the next frame to glcalls.txt\n";
+#endif
 
 		cout << "* please give us the setting file:" << endl;
 	
@@ -89,6 +288,8 @@ int main()
 	cin >> file;
 
 	glfwInit();
+	// terminates glfw when main returns, after the shaders and models below deleted their GL objects
+	struct GlfwSession { ~GlfwSession() { glfwTerminate(); } } glfwSession;
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -112,6 +313,8 @@ int main()
 	glfwSetKeyCallback(window, press_key);
 	glfwMakeContextCurrent(window);
 	glfwSetScrollCallback(window, scroll);
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+	glfwSetWindowRefreshCallback(window, refresh_window);
 
 	glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
@@ -122,71 +325,689 @@ int main()
 		std::cout << "Failed to initialize GLAD" << std::endl;
 		return -1;
 	}
+	GL_CALLS_INSTALL();
 
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_SCISSOR_TEST);
+	SceneResources scene(file, (GLADloadproc)glfwGetProcAddress);
 
-	//shader loaded in
-	Shader modelShader("shader/model.vs", "shader/model.fs");
-	Shader lightShader("shader/light.vs", "shader/light.fs");
+	//two eye rendering
+	bool flush = false;
+	while (!glfwWindowShouldClose(window))
+	{	
+		//both eyes of a frame are drawn once it has started, changes arriving in between go to the next one
+		if (!flush) {
+			if (!redraw || SCR_WIDTH == 0 || SCR_HEIGHT == 0) {
+				TRACE_SCOPE("wait events");
+				glfwWaitEvents();
+				continue;
+			}
+			redraw = false;
+			begin_frame(scene);
+		}
 
-	Model backgroundModel("objs/background.obj");
-	Model lightModel("objs/lamp.obj");
-	Model sky("objs/sky.obj");
+		render_stereo_eye(scene, flush ? RIGHT_CAMERA : LEFT_CAMERA, 0);
+		
+		if (flush) {
+			end_frame();
+			if (showStats)
+				draw_stats_hud(scene, 0);
+			PROFILE_CPU_SCOPE("swap");
+			glfwSwapBuffers(window);
+		}
+		flush = !flush;
+		glfwPollEvents();
+	}
 
+	// the objects are global, release them while the context still exists;
+	// glfw is terminated by glfwSession once the locals are gone
+	// ------------------------------------------------------------------
+	release_globals();
+	return 0;
+}
 
-	//file = "setting.txt";
-	parsesetting(file);
-	
+SceneResources::SceneResources(string setting_file, GLADloadproc load)
+	: modelShader("shader/model_clustered.vs", "shader/model_clustered.fs"),
+	lightShader("shader/light.vs", "shader/light.fs"),
+	skyShader("shader/sky.vs", "shader/sky.fs"),
+	depthShader("shader/depth.vs", "shader/depth.fs"),
+	shadowShader("shader/shadow_depth.vs", "shader/shadow_depth.fs", "shader/shadow_depth.gs"),
+	reprojectShader("shader/reproject.vs", "shader/reproject.fs"),
+	holeFillShader("shader/holefill.vs", "shader/holefill.fs"),
+	foveateShader("shader/foveate.vs", "shader/foveate.fs"),
+	hudShader("shader/hud.vs", "shader/hud.fs"),
+	backgroundModel("objs/background.obj"),
+	lightModel("objs/lamp.obj"),
+	sky("objs/sky.obj")
+{
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_SCISSOR_TEST);
+
+	transforms.setup(load);
+	transforms.attach(modelShader);
+	transforms.attach(depthShader);
+	transforms.attach(shadowShader);
+
+	parsesetting(setting_file);
 
 	backgroundModel.getmatrix(vec3(0.0f, -0.5f, 0.0f), vec4(0, 0, 0, 0), vec3(0.5, 0.5, 0.5));
-	sky.getmatrix(vec3(0, 0, 0), vec4(0, 0, 0, 0), vec3(100, 100, 100));
+	sky.getmatrix(vec3(0, 0, 0), vec4(0, 0, 0, 0), vec3(1, 1, 1));
 	lightModel.getmatrix(light_pos, vec4(0, 0, 0, 0), vec3(1, 1, 1));
-	
+	lampModel = &lightModel;
+	memoryTracker().checkBudget(cout);
+}
 
-	//two eye rendering
-	bool flush = false;
-	while (!glfwWindowShouldClose(window))
-	{	
+// work shared by both eyes of a frame: the transform ring and the cached shadow cube
+void begin_frame(SceneResources &scene)
+{
+	TRACE_SCOPE("begin_frame");
+	PROFILE_BEGIN_FRAME();
+	GL_CALLS_BEGIN_FRAME();
+	renderStats().beginFrame();
+	frameReprojectMode = reprojectMode;
+	dynamicResolution.beginFrame();
+	upload_transforms(scene.backgroundModel);
+
+	if (useShadows) {
+		PROFILE_SCOPE("shadow cube");
+		static vector<int> nearLamp;
+		sceneIndex.inRange(objs, light_pos, shadows.range, nearLamp);
+		vector<Model*> casters;
+		casters.push_back(&scene.backgroundModel);
+		for (unsigned int i = 0; i < nearLamp.size(); i++)
+			casters.push_back(&objs[nearLamp[i]]);
+		shadows.update(scene.shadowShader, light_pos, casters, transforms);
+	}
+}
 
-		if (!flush) {
-			eyemode = LEFT_CAMERA;
-			glScissor(0, 0, SCR_WIDTH / 2, SCR_HEIGHT);
-			glViewport(0, 0, SCR_WIDTH / 2, SCR_HEIGHT);
+mat4 eye_projection()
+{
+	return glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+}
+
+mat4 eye_view(int eye)
+{
+	if (eye == LEFT_CAMERA)
+		return glm::lookAt(lefteye, left_viewat, headup);
+	return glm::lookAt(righteye, right_viewat, headup);
+}
+
+// draws one eye into its part of the bound framebuffer, viewport is (x, y, width, height);
+// without clear it only adds to what is there, for the holes of a reprojected eye.
+// crop goes after the projection, to render only a rectangle of the eye into viewport
+void render_eye(SceneResources &scene, int eye, vec4 viewport, bool clear, mat4 crop)
+{
+	eyemode = eye;
+	glScissor((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+	glViewport((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+	eyeViewport = viewport;
+
+	scene.lightModel.obj_pos = light_pos;
+
+	if (clear) {
+		glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	// view/projection transformations
+	mat4 projection = crop * eye_projection();
+	mat4 view = eye_view(eyemode);
+
+	if (occlusionCulling)
+		render_occluders(scene.backgroundModel, projection, view);
+	select_visible(projection, view);
+	{
+		PROFILE_CPU_SCOPE("light clusters");
+		pointLights.update(view, projection, 0.1f, 100.0f);
+	}
+
+	if (depthPrepass) {
+		render_depth(scene.depthShader, scene.backgroundModel, projection, view);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	render_scene(scene.modelShader, scene.backgroundModel, scene.lightModel, projection, view);
+	render_model(scene.modelShader, scene.lightModel, projection,view);
+	if (depthPrepass) {
+		glDepthMask(GL_TRUE);
+		glDepthFunc(GL_LESS);
+	}
+	render_light(scene.lightShader, scene.lightModel, projection, view);
+	render_sky(scene.skyShader, scene.sky, projection, view);
+}
+
+/*
+	one eye of the stereo frame into its half of framebuffer. With reprojection on,
+	the left eye goes through the reprojector's source target and the right eye is
+	warped from it: its holes are then rendered again or filled, per reprojectMode.
+	The left eye must be drawn first. With dynamic resolution the eyes are rendered
+	into a texture at the frame's scale and stretched over their half. Foveation
+	only applies to fully rendered eyes, the reprojection needs a whole source eye;
+	dynamic resolution then scales its periphery only.
+*/
+void render_stereo_eye(SceneResources &scene, int eye, unsigned int framebuffer)
+{
+	PROFILE_SCOPE(eye == LEFT_CAMERA ? "left eye" : "right eye");
+	renderStats().setPart(eye == LEFT_CAMERA ? STATS_LEFT : STATS_RIGHT);
+	vec4 viewport = eye == LEFT_CAMERA ? vec4(0, 0, SCR_WIDTH / 2, SCR_HEIGHT) : vec4(SCR_WIDTH / 2, 0, SCR_WIDTH / 2, SCR_HEIGHT);
+	int width = dynamicResolution.scaled(SCR_WIDTH / 2), height = dynamicResolution.scaled(SCR_HEIGHT);
+	if (frameReprojectMode == REPROJECT_OFF && foveaMode != FOVEA_OFF) {
+		FoveatedRenderer &foveation = scene.foveation;
+		foveation.insetSize = foveaInset;
+		foveation.peripheryScale = foveaPeriphery;
+		foveation.setup(SCR_WIDTH / 2, SCR_HEIGHT, fovea_centre(), float(width) / (SCR_WIDTH / 2));
+		foveation.bindPeriphery();
+		render_eye(scene, eye, vec4(0, 0, foveation.peripheryWidth, foveation.peripheryHeight), false);
+		foveation.bindInset();
+		render_eye(scene, eye, vec4(0, 0, foveation.inset.z, foveation.inset.w), true, foveation.insetCrop());
+		PROFILE_SCOPE("foveation composite");
+		foveation.composite(scene.foveateShader, framebuffer, viewport);
+		return;
+	}
+	if (frameReprojectMode == REPROJECT_OFF) {
+		if (width == SCR_WIDTH / 2 && height == SCR_HEIGHT) {
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+			render_eye(scene, eye, viewport);
+			return;
 		}
+		scene.eyeTarget.resize(SCR_WIDTH / 2, SCR_HEIGHT);
+		scene.eyeTarget.bind();
+		render_eye(scene, eye, vec4(0, 0, width, height));
+		scene.eyeTarget.blit(width, height, framebuffer, viewport);
+		return;
+	}
+
+	StereoReprojector &reprojector = scene.reprojector;
+	reprojector.resize(SCR_WIDTH / 2, SCR_HEIGHT);
+	if (eye == LEFT_CAMERA) {
+		reprojector.bindSource(width, height);
+		render_eye(scene, LEFT_CAMERA, vec4(0, 0, reprojector.width, reprojector.height));
+		reprojector.presentSource(framebuffer, viewport);
+		return;
+	}
+	vec4 eyeViewport(0, 0, reprojector.width, reprojector.height);
+
+	mat4 projection = eye_projection();
+	mat4 leftView = eye_view(LEFT_CAMERA), rightView = eye_view(RIGHT_CAMERA);
+	{
+		PROFILE_SCOPE("reproject");
+		// single pixel points leave cracks, which the rerender mode shades exactly and the fill mode would smear
+		reprojector.reproject(scene.reprojectShader, projection * leftView, projection * rightView,
+			projection * mat4(mat3(leftView)), projection * mat4(mat3(rightView)), frameReprojectMode == REPROJECT_RERENDER ? 1.0f : 2.0f);
+	}
+	if (frameReprojectMode == REPROJECT_RERENDER) {
+		render_eye(scene, RIGHT_CAMERA, eyeViewport, false);
+		reprojector.presentTarget(framebuffer, viewport);
+	}
+	else {
+		PROFILE_SCOPE("hole fill");
+		reprojector.fillTarget(scene.holeFillShader, framebuffer, viewport);
+	}
+}
+
+// the fovea in 0..1 of an eye: the middle, or the cursor over either half while it is shown
+vec2 fovea_centre()
+{
+	if (foveaMode != FOVEA_CURSOR || !selectMode)
+		return vec2(0.5f);
+	float half = SCR_WIDTH / 2.0f;
+	float x = cursorPosition.x < half ? cursorPosition.x : cursorPosition.x - half;
+	return vec2(glm::clamp(x / half, 0.0f, 1.0f), glm::clamp(1.0f - cursorPosition.y / SCR_HEIGHT, 0.0f, 1.0f));
+}
+
+// after the last draw of a frame
+void end_frame()
+{
+	TRACE_SCOPE("end_frame");
+	transforms.endFrame();
+	dynamicResolution.endFrame();
+	PROFILE_END_FRAME();
+	GL_CALLS_END_FRAME();
+	renderStats().endFrame();
+}
+
+// 1234567 as 1.23M, to keep the lines of the HUD short
+static string stats_count(double value)
+{
+	char text[32];
+	if (value >= 1e6)
+		snprintf(text, sizeof(text), "%.2fM", value / 1e6);
+	else if (value >= 1e4)
+		snprintf(text, sizeof(text), "%.1fK", value / 1e3);
+	else
+		snprintf(text, sizeof(text), "%.0f", value);
+	return text;
+}
+
+static void stats_lines(vector<string> &lines, const string &name, const RenderCounters &c)
+{
+	lines.push_back(name + ": " + stats_count(c.drawCalls) + " draws " + stats_count((double)c.triangles) + " tris "
+		+ stats_count((double)c.bytesUploaded) + "B up");
+	lines.push_back("  binds " + stats_count(c.programBinds) + " prog " + stats_count(c.textureBinds) + " tex "
+		+ stats_count(c.vaoBinds) + " vao " + stats_count(c.uniformUpdates) + " unif");
+	if (c.objectsCulled || c.meshesCulled)
+		lines.push_back("  culled " + stats_count(c.objectsCulled) + " objs " + stats_count(c.meshesCulled) + " meshes");
+}
+
+// the counters of the last frame in the top left corner of each eye of framebuffer, after end_frame;
+// an eye shows its own part, the shared one and the frame total
+void draw_stats_hud(SceneResources &scene, unsigned int framebuffer)
+{
+	RenderStats &stats = renderStats();
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	for (int eye = LEFT_CAMERA; eye <= RIGHT_CAMERA; eye++) {
+		int part = eye == LEFT_CAMERA ? STATS_LEFT : STATS_RIGHT;
+		vector<string> lines;
+		stats_lines(lines, RenderStats::partName(part), stats.last[part]);
+		stats_lines(lines, RenderStats::partName(STATS_SHARED), stats.last[STATS_SHARED]);
+		stats_lines(lines, "frame", stats.lastTotal());
+		if (stats.recording())
+			lines.push_back("recording csv");
+
+		vec4 viewport = eye == LEFT_CAMERA ? vec4(0, 0, SCR_WIDTH / 2, SCR_HEIGHT) : vec4(SCR_WIDTH / 2, 0, SCR_WIDTH / 2, SCR_HEIGHT);
+		scene.hud.draw(scene.hudShader, lines, viewport);
+	}
+}
+
+//headless when built with a backend; a hidden glfw window only when --window-fallback asked for it
+GLADloadproc OffscreenContext::create()
+{
+	if (HeadlessContext::available() || !windowFallback)
+		return headless.create(SCR_WIDTH, SCR_HEIGHT) ? headless.loader() : NULL;
+
+	if (!glfwInit()) {
+		std::cout << "Failed to initialize GLFW" << std::endl;
+		return NULL;
+	}
+	glfw = true;
+	cout << "* not headless: rendering through a hidden glfw window (--window-fallback)" << endl;
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+#ifdef __APPLE__
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "twoeye_modelling", NULL, NULL);
+	if (window == NULL)
+	{
+		std::cout << "Failed to create GLFW window" << std::endl;
+		return NULL;
+	}
+	glfwMakeContextCurrent(window);
+	return (GLADloadproc)glfwGetProcAddress;
+}
+
+//places both eyes the way the mouse and keyboard callbacks do
+void set_camera(vec3 eye, float yaw, float up, vec3 eyeDelta)
+{
+	lefteye = eye;
+	theta = yaw;
+	viewUp = up;
+	delta = eyeDelta;
+	righteye = lefteye + delta;
+
+	left_viewat.x = float(lefteye.x + cos(theta));
+	left_viewat.z = float(lefteye.z + sin(theta));
+	left_viewat.y = float(lefteye.y + viewUp);
+	right_viewat = left_viewat;
+}
+
+//the GL objects held by globals; they would outlive the context, so every mode calls this before tearing it down
+void release_globals()
+{
+	objs.clear();
+	sceneIndex.invalidate();
+	pickedObject = -1;
+	pointLights.release();
+	shadows.release();
+	transforms.release();
+	dynamicResolution.release();
+}
+
+// renders frames stereo pairs without a window and writes the last one to output
+int run_headless(string setting_file, string output, int frames)
+{
+	OffscreenContext context;
+	GLADloadproc load = context.create();
+	if (!load)
+		return -1;
+	if (!gladLoadGLLoader(load))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return -1;
+	}
+	GL_CALLS_INSTALL();
+	cout << "* offscreen: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << endl;
+
+	int status = 0;
+	{
+		SceneResources scene(setting_file, load);
+		OffscreenTarget target(SCR_WIDTH, SCR_HEIGHT);
+		target.bind();
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			begin_frame(scene);
+			render_stereo_eye(scene, LEFT_CAMERA, target.framebuffer());
+			render_stereo_eye(scene, RIGHT_CAMERA, target.framebuffer());
+			end_frame();
+		}
+		glFinish();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "* " << frames << " stereo frames in " << seconds << " s, " << frames / seconds << " frames/s" << endl;
+		PROFILE_REPORT(cout);
+		GL_CALLS_REPORT(cout);
+		memoryTracker().report(cout);
+
+		vector<unsigned char> pixels;
+		target.read(pixels);
+		if (writePNG(output, SCR_WIDTH, SCR_HEIGHT, &pixels[0]))
+			cout << "* written " << output << endl;
 		else {
-			eyemode = RIGHT_CAMERA;
-			glScissor(SCR_WIDTH / 2, 0, SCR_WIDTH / 2, SCR_HEIGHT);
-			glViewport(SCR_WIDTH / 2, 0, SCR_WIDTH / 2, SCR_HEIGHT);
+			cout << "* could not write " << output << endl;
+			status = -1;
 		}
-		
-		lightModel.obj_pos = light_pos;
 
-		glClearColor(0.75f, 0.75f, 0.75f, 1.0f);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		release_globals();
+	}
+	return status;
+}
 
-		// view/projection transformations
-		mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		mat4 view;
-		if(eyemode == LEFT_CAMERA)view = glm::lookAt(lefteye, left_viewat, headup);
-		else view = glm::lookAt(righteye, right_viewat, headup);
+/*
+	renders one stereo pair per line of the path file,
+		lefteye.x lefteye.y lefteye.z theta viewUp delta.x delta.y delta.z
+	into output_dir/frame_NNNNN.png. The frames are read back through a ring of
+	PBOs and encoded on worker threads, so the GPU never waits for either.
+*/
+int run_path(string setting_file, string path_file, string output_dir)
+{
+	struct PathPoint {
+		vec3 eye;
+		float theta, up;
+		vec3 delta;
+	};
+	vector<PathPoint> path;
+	ifstream fin(path_file);
+	if (!fin) {
+		cout << " path file does not exist ! " << endl;
+		return -1;
+	}
+	string line;
+	while (getline(fin, line)) {
+		if (line.empty() || line[0] == '#')
+			continue;
+		istringstream in(line);
+		PathPoint point;
+		if (in >> point.eye.x >> point.eye.y >> point.eye.z >> point.theta >> point.up >> point.delta.x >> point.delta.y >> point.delta.z)
+			path.push_back(point);
+	}
 
-		render_scene(modelShader, backgroundModel,sky, lightModel, projection, view);
-		render_light(lightShader, lightModel, projection, view);
-		render_model(modelShader, lightModel, projection,view);
-		
-		if (flush)glfwSwapBuffers(window);
-		flush = !flush;
-		glfwPollEvents();
+	OffscreenContext context;
+	GLADloadproc load = context.create();
+	if (!load)
+		return -1;
+	if (!gladLoadGLLoader(load))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return -1;
 	}
+	GL_CALLS_INSTALL();
+	cout << "* offscreen: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << endl;
 
-	// glfw: terminate, clearing all previously allocated GLFW resources.
-	// ------------------------------------------------------------------
-	glfwTerminate();
+	int status = 0;
+	{
+		SceneResources scene(setting_file, load);
+		OffscreenTarget target(SCR_WIDTH, SCR_HEIGHT);
+		ReadbackRing readback(SCR_WIDTH, SCR_HEIGHT);
+		ImageWriteQueue writer;
+		vector<unsigned char> pixels;
+
+		// the oldest frame in the ring goes to the encoders
+		auto save = [&]() {
+			int frame = readback.pop(pixels);
+			char name[32];
+			sprintf(name, "/frame_%05d.png", frame);
+			writer.push(output_dir + name, SCR_WIDTH, SCR_HEIGHT, std::move(pixels));
+		};
+
+		target.bind();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (size_t frame = 0; frame < path.size(); frame++) {
+			set_camera(path[frame].eye, path[frame].theta, path[frame].up, path[frame].delta);
+			begin_frame(scene);
+			render_stereo_eye(scene, LEFT_CAMERA, target.framebuffer());
+			render_stereo_eye(scene, RIGHT_CAMERA, target.framebuffer());
+			end_frame();
+
+			if (readback.full())
+				save();
+			readback.queue((int)frame);
+		}
+		while (!readback.empty())
+			save();
+		writer.finish();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		cout << "* " << path.size() << " stereo frames in " << seconds << " s, " << path.size() / seconds << " frames/s" << endl;
+		cout << "* " << readback.stalls << " readback stalls, " << writer.blocked << " waits for the encoders, "
+			<< writer.failed << " images not written" << endl;
+		if (dynamicResolution.enabled)
+			cout << "* dynamic resolution: scale " << dynamicResolution.scale << " after " << dynamicResolution.changes
+				<< " changes, " << dynamicResolution.gpuMs << " ms GPU per frame for a budget of " << dynamicResolution.budgetMs << endl;
+		if (foveaMode != FOVEA_OFF)
+			cout << "* foveation: at most " << scene.foveation.shadedFraction() * 100.0f << "% of the fragments of an eye shaded" << endl;
+		PROFILE_REPORT(cout);
+		GL_CALLS_REPORT(cout);
+		memoryTracker().report(cout);
+		if (writer.failed)
+			status = -1;
+
+		release_globals();
+	}
+	return status;
+}
+
+/*
+	renders the stereo pair with every reprojection mode and prints the time per
+	frame, the share of holes in the warped eye and its error against the fully
+	rendered right eye, to decide whether the saving is worth it for a scene
+*/
+int bench_reproject(string setting_file, int frames)
+{
+	OffscreenContext context;
+	GLADloadproc load = context.create();
+	if (!load)
+		return -1;
+	if (!gladLoadGLLoader(load))
+	{
+		std::cout << "Failed to initialize GLAD" << std::endl;
+		return -1;
+	}
+	GL_CALLS_INSTALL();
+	cout << "* offscreen: " << glGetString(GL_RENDERER) << ", " << glGetString(GL_VERSION) << endl;
+
+	{
+		SceneResources scene(setting_file, load);
+		OffscreenTarget target(SCR_WIDTH, SCR_HEIGHT);
+		const char *names[] = { "full", "rerender", "fill" };
+		vector<unsigned char> reference, pixels, right;
+
+		for (int mode = REPROJECT_OFF; mode <= REPROJECT_FILL; mode++) {
+			reprojectMode = mode;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (int frame = 0; frame < frames; frame++) {
+				begin_frame(scene);
+				render_stereo_eye(scene, LEFT_CAMERA, target.framebuffer());
+				render_stereo_eye(scene, RIGHT_CAMERA, target.framebuffer());
+				end_frame();
+			}
+			glFinish();
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+
+			// the right half of the last frame
+			target.read(pixels);
+			int half = SCR_WIDTH / 2;
+			right.resize((size_t)half * SCR_HEIGHT * 4);
+			for (int y = 0; y < SCR_HEIGHT; y++)
+				memcpy(&right[(size_t)y * half * 4], &pixels[((size_t)y * SCR_WIDTH + half) * 4], (size_t)half * 4);
+
+			cout << "* " << names[mode] << ": " << ms << " ms per stereo frame";
+			if (mode == REPROJECT_OFF)
+				reference = right;
+			else {
+				ImageError error = compareImages(reference, right);
+				cout << ", holes " << scene.reprojector.holeFraction() * 100.0 << "%, rmse " << error.rmse
+					<< ", psnr " << error.psnr << " dB, " << error.badPixels * 100.0 << "% of pixels off by more than 16";
+			}
+			cout << endl;
+		}
+		reprojectMode = REPROJECT_OFF;
+		release_globals();
+	}
+	return 0;
+}
+
+SoftwareScene::SoftwareScene(string setting_file)
+	: backgroundModel("objs/background.obj"),
+	lightModel("objs/lamp.obj")
+{
+	parsesetting(setting_file);
+
+	backgroundModel.getmatrix(vec3(0.0f, -0.5f, 0.0f), vec4(0, 0, 0, 0), vec3(0.5, 0.5, 0.5));
+	lightModel.getmatrix(light_pos, vec4(0, 0, 0, 0), vec3(1, 1, 1));
+}
+
+// hands every mesh of the scene to a CPU renderer (SoftwareRasterizer or RayTracer),
+// with the lamp settings of render_scene and render_model
+template <class Renderer> void submit_software_scene(Renderer &renderer, SoftwareScene &scene)
+{
+	// render_scene and render_model attenuate the lamp differently
+	SoftLight light = { light_pos, ambient, diffuse, vec3(1.0f), 1.0f, 0.09f, 0.032f, 32.0f };
+	Model &background = scene.backgroundModel;
+	for (unsigned int i = 0; i < background.meshes.size(); i++)
+		renderer.draw(background.meshes[i], background.meshMatrix(i), background.graph.nodes[background.mesh_node[i]].normal, light);
+	light.linear = 0.1f;
+	light.quadratic = 0.05f;
+	for (unsigned int k = 0; k < objs.size(); k++) {
+		for (unsigned int i = 0; i < objs[k].meshes.size(); i++)
+			renderer.draw(objs[k].meshes[i], objs[k].meshMatrix(i), objs[k].graph.nodes[objs[k].mesh_node[i]].normal, light);
+	}
+
+	// the lamp as render_light places it
+	mat4 lampTransfor = lamp_transform(light_pos);
+	for (unsigned int i = 0; i < scene.lightModel.meshes.size(); i++)
+		renderer.drawUnlit(scene.lightModel.meshes[i], lampTransfor * scene.lightModel.meshObjectMatrix(i), vec3(1.0f));
+}
+
+// both eyes on the CPU, with the cameras and projection of render_eye
+void render_software(SoftwareRasterizer &raster, SoftwareScene &scene)
+{
+	mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	raster.beginFrame();
+	raster.addView(vec4(0, 0, SCR_WIDTH / 2, SCR_HEIGHT), glm::lookAt(lefteye, left_viewat, headup), projection, lefteye);
+	raster.addView(vec4(SCR_WIDTH / 2, 0, SCR_WIDTH / 2, SCR_HEIGHT), glm::lookAt(righteye, right_viewat, headup), projection, righteye);
+	submit_software_scene(raster, scene);
+	raster.render();
+}
+
+// renders frames stereo pairs with the software rasterizer and writes the last one to output
+int run_software(string setting_file, string output, int frames)
+{
+	uploadToGL = false;
+	int status = 0;
+	{
+		SoftwareScene scene(setting_file);
+		SoftwareRasterizer raster(SCR_WIDTH, SCR_HEIGHT);
+		cout << "* software rasterizer, " << raster.threads() << " threads" << endl;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++)
+			render_software(raster, scene);
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "* " << frames << " stereo frames in " << seconds << " s, " << frames / seconds << " frames/s" << endl;
+		cout << "* last frame: " << raster.triangles << " triangles in " << raster.tileRefs << " tile bins, vertices "
+			<< raster.vertexMs << " ms, setup " << raster.setupMs << " ms, tiles " << raster.tileMs << " ms" << endl;
+
+		if (writePNG(output, SCR_WIDTH, SCR_HEIGHT, &raster.color[0]))
+			cout << "* written " << output << endl;
+		else {
+			cout << "* could not write " << output << endl;
+			status = -1;
+		}
+		objs.clear();
+	}
+	return status;
+}
+
+// stereo frame time of the software rasterizer for 1, 2, 4, ... threads, to size CPU only hosts
+int bench_raster(string setting_file, int frames)
+{
+	uploadToGL = false;
+	{
+		SoftwareScene scene(setting_file);
+		unsigned int most = std::max(thread::hardware_concurrency(), 1u);
+		for (unsigned int threads = 1; ; threads = std::min(threads * 2, most)) {
+			ThreadPool pool(threads);
+			SoftwareRasterizer raster(SCR_WIDTH, SCR_HEIGHT, pool);
+			render_software(raster, scene);		// warm up the allocations
+
+			double vertexMs = 0, setupMs = 0, tileMs = 0;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for (int frame = 0; frame < frames; frame++) {
+				render_software(raster, scene);
+				vertexMs += raster.vertexMs;
+				setupMs += raster.setupMs;
+				tileMs += raster.tileMs;
+			}
+			double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+			cout << threads << " threads: " << ms << " ms per stereo frame, " << 1000.0 / ms << " frames/s, "
+				<< raster.triangles / ms / 1000.0 << " M triangles/s (vertices " << vertexMs / frames << " ms, setup "
+				<< setupMs / frames << " ms, tiles " << tileMs / frames << " ms)" << endl;
+			if (threads == most)
+				break;
+		}
+		objs.clear();
+	}
 	return 0;
 }
 
+// ray traced reference images of both eyes, each the size of its half of the window
+int run_raytrace(string setting_file, string output_prefix, int samples)
+{
+	uploadToGL = false;
+	int status = 0;
+	{
+		SoftwareScene scene(setting_file);
+		RayTracer tracer;
+		submit_software_scene(tracer, scene);
+		tracer.build();
+		cout << "* BVH over " << tracer.triangleCount() << " triangles, " << tracer.nodeCount() << " nodes, built in "
+			<< tracer.buildMs << " ms" << endl;
+
+		mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		const char *names[2] = { "left", "right" };
+		vec3 eyes[2] = { lefteye, righteye };
+		vec3 targets[2] = { left_viewat, right_viewat };
+		vector<unsigned char> pixels;
+		for (int eye = 0; eye < 2; eye++) {
+			tracer.render(SCR_WIDTH / 2, SCR_HEIGHT, glm::lookAt(eyes[eye], targets[eye], headup), projection, eyes[eye], samples, pixels);
+			cout << "* " << names[eye] << " eye: " << tracer.primaryRays << " primary and " << tracer.shadowRays
+				<< " shadow rays in " << tracer.renderMs << " ms, " << tracer.raysPerSecond() / 1e6 << " M rays/s on "
+				<< workerPool().size() << " threads" << endl;
+			string output = output_prefix + "_" + names[eye] + ".png";
+			if (writePNG(output, SCR_WIDTH / 2, SCR_HEIGHT, &pixels[0]))
+				cout << "* written " << output << endl;
+			else {
+				cout << "* could not write " << output << endl;
+				status = -1;
+			}
+		}
+		objs.clear();
+	}
+	return status;
+}
+
 void parsesetting(string setting_file) {
+	TRACE_SCOPE_DETAIL("parsesetting", setting_file.c_str());
 	ifstream fin(setting_file);
 
 
@@ -208,7 +1029,14 @@ void parsesetting(string setting_file) {
 			fin >> scale.x >> scale.y >> scale.z;
 			//read in objs
 			obj.getmatrix(translate, rotate, scale);
-			objs.push_back(obj);
+			objs.push_back(std::move(obj));
+			sceneIndex.invalidate();
+		}
+
+		//the last object hides what is behind it
+		else if (input.find("occluder") != string::npos) {
+			if (!objs.empty())
+				objs.back().occluder = true;
 		}
 
 		else if (input.find("camera") != string::npos) {
@@ -227,11 +1055,53 @@ void parsesetting(string setting_file) {
 		else if (input.find("light_diffuse") != string::npos) {
 			fin >> diffuse.x >> diffuse.y >> diffuse.z;
 		}
+		else if (input.find("point_light") != string::npos) {
+			PointLight light;
+			fin >> light.position.x >> light.position.y >> light.position.z;
+			fin >> light.color.x >> light.color.y >> light.color.z;
+			fin >> light.radius;
+			pointLights.lights.push_back(light);
+		}
+
+		//share of each eye per axis at full resolution and resolution of the rest, turns the foveation on
+		else if (input.find("foveation") != string::npos) {
+			fin >> foveaInset >> foveaPeriphery;
+			foveaMode = FOVEA_CENTRE;
+		}
+
+		//file to write the render counters of every frame to
+		else if (input.find("stats_csv") != string::npos) {
+			string path;
+			fin >> path;
+			renderStats().startCsv(path);
+		}
+
+		//file to write every GL call of the first frame to, in builds with GL_CALLS
+		else if (input.find("gl_call_log") != string::npos) {
+			string path;
+			fin >> path;
+			GL_CALLS_CAPTURE(path);
+		}
+
+		//CPU and GPU megabytes the scene should fit in, checked once it is loaded
+		else if (input.find("memory_budget") != string::npos) {
+			double cpu, gpu;
+			fin >> cpu >> gpu;
+			memoryTracker().budget[0] = (size_t)(cpu * 1024.0 * 1024.0);
+			memoryTracker().budget[1] = (size_t)(gpu * 1024.0 * 1024.0);
+		}
+
+		//GPU milliseconds per stereo frame, turns the dynamic resolution on
+		else if (input.find("frame_budget") != string::npos) {
+			fin >> dynamicResolution.budgetMs;
+			dynamicResolution.enabled = true;
+		}
 
 	}
 }
 
-void render_scene(Shader modelShader, Model background, Model sky, Model lightModel, mat4 projection, mat4 view) {
+void render_scene(Shader &modelShader, Model &background, Model &lightModel, mat4 projection, mat4 view) {
+	PROFILE_SCOPE("render_scene");
 	modelShader.use();
 	// be sure to activate shader when setting uniforms/drawing objects
 	modelShader.setVec3("light.position", lightModel.obj_pos);
@@ -255,42 +1125,65 @@ void render_scene(Shader modelShader, Model background, Model sky, Model lightMo
 
 	modelShader.setMat4("projection", projection);
 	modelShader.setMat4("view", view);
+	pointLights.bind(modelShader, eyeViewport);
+	shadows.bind(modelShader, useShadows);
 
-	mat4 modelTransfor = mat4(1.0f);
-	modelTransfor = translate(modelTransfor, background.obj_pos); // translate it down so it's at the center of the scene
-	modelTransfor = scale(modelTransfor,background.scale);
-	modelShader.setMat4("model", modelTransfor);
-	background.Draw(modelShader);
+	Frustum frustum(projection * view);
 
-	mat4 skyTransfor = mat4(1.0f);
-	skyTransfor = translate(skyTransfor,sky.obj_pos);
-	skyTransfor = scale(skyTransfor, sky.scale);
-	modelShader.setMat4("model", skyTransfor);
-	sky.Draw(modelShader);
+	// same matrix as the depth pre-pass, depth func EQUAL needs bit identical positions
+	background.Draw(modelShader, frustum, transforms);
 
 	return;
 }
 
-void render_light(Shader lightShader, Model lightModel, mat4 projection, mat4 view)
+// the sky goes last, unlit and on the far plane, so it is only shaded where nothing else was drawn
+void render_sky(Shader &skyShader, Model &sky, mat4 projection, mat4 view)
 {
-	mat4 lampTransfor = mat4(1.0f);
+	PROFILE_SCOPE("render_sky");
+	glDepthFunc(GL_LEQUAL);
+	glDepthMask(GL_FALSE);
 
-	lampTransfor = translate(lampTransfor, lightModel.obj_pos);
-	lampTransfor = scale(lampTransfor, vec3(0.2f)); // a smaller cube
+	skyShader.use();
+	skyShader.setMat4("projection", projection);
+	skyShader.setMat4("view", view);
+	skyShader.setBool("hasTexture", !sky.textures_loaded.empty());
+	sky.Draw(skyShader, mat4(1.0f));
+
+	glDepthMask(GL_TRUE);
+	glDepthFunc(GL_LESS);
+
+	return;
+}
+
+void render_light(Shader &lightShader, Model &lightModel, mat4 projection, mat4 view)
+{
+	PROFILE_SCOPE("render_light");
+	mat4 lampTransfor = lamp_transform(lightModel.obj_pos);
+
+	BoundingSphere lampSphere = sphereOf(transformAABB(lightModel.local_bounds, lampTransfor));
+	if (!Frustum(projection * view).testSphere(lampSphere.center, lampSphere.radius))
+		return;
 
 	lightShader.use();
 
 	lightShader.setMat4("projection", projection);
 	lightShader.setMat4("view", view);
-	lightShader.setMat4("model", lampTransfor);
 
-	lightModel.Draw(lightShader);
+	lightModel.Draw(lightShader, lampTransfor);
 
 	return;
 }
 
-void render_model(Shader modelShader, Model lightModel, mat4 projection, mat4 view)
+//placement of the lamp model at position, a smaller cube; drawing, culling, picking and the CPU renderers
+//all go through it, so the lamp is hit where it is seen
+mat4 lamp_transform(vec3 position)
+{
+	return scale(translate(mat4(1.0f), position), vec3(0.2f));
+}
+
+void render_model(Shader &modelShader, Model &lightModel, mat4 projection, mat4 view)
 {
+	PROFILE_SCOPE("render_model");
 	// render the loaded model
 
 	// don't forget to enable shader before setting uniforms
@@ -317,23 +1210,122 @@ void render_model(Shader modelShader, Model lightModel, mat4 projection, mat4 vi
 
 	modelShader.setMat4("projection", projection);
 	modelShader.setMat4("view", view);
+	pointLights.bind(modelShader, eyeViewport);
+	shadows.bind(modelShader, useShadows);
 
-	for (int i = 0; i < objs.size(); i++) {
-		mat4 modelTransfor = mat4(1.0f);
+	Frustum frustum(projection * view);
+	for (unsigned int k = 0; k < visibleObjs.size(); k++) {
+		int i = visibleObjs[k];
+		objs[i].Draw(modelShader, frustum, transforms, visibleLods[k]);
+	}
+
+	return;
+}
 
-		modelTransfor = translate(modelTransfor, objs[i].obj_pos); // translate it down so it's at the center of the scene
-		modelTransfor = rotate(modelTransfor, objs[i].rotate.x, vec3(objs[i].rotate.y, objs[i].rotate.z, objs[i].rotate.w));
-		modelTransfor = scale(modelTransfor, objs[i].scale);
-		modelShader.setMat4("model", modelTransfor);
+// culls the objects for the current eye and picks their level of detail,
+// the depth and colour passes both draw exactly this list
+void select_visible(mat4 projection, mat4 view)
+{
+	PROFILE_CPU_SCOPE("select_visible");
+	vec3 position;
+	if (eyemode == LEFT_CAMERA)position = lefteye;
+	else position = righteye;
 
-		objs[i].Draw(modelShader);
+	// whole objects first, from the scene hierarchy and then their spheres; Model::Draw culls the meshes of the survivors
+	Frustum frustum(projection * view);
+	static vector<int> candidates;
+	sceneIndex.inFrustum(objs, frustum, candidates);
+
+	visibleObjs.clear();
+	visibleLods.clear();
+	renderCounters().objectsCulled += (unsigned int)(objs.size() - candidates.size());
+	for (unsigned int c = 0; c < candidates.size(); c++) {
+		int i = candidates[c];
+		if (!frustum.testSphere(objs[i].world_sphere.center, objs[i].world_sphere.radius) ||
+			(occlusionCulling && !occlusion.visible(objs[i].world_bounds))) {
+			renderCounters().objectsCulled++;
+			continue;
+		}
+		visibleObjs.push_back(i);
+		visibleLods.push_back(useLod ? objs[i].lodFor(position, projection) : 0);
 	}
+}
 
-	return;
+// writes the matrices of the background and every object into the next segment of the ring
+void upload_transforms(Model &background)
+{
+	PROFILE_CPU_SCOPE("upload_transforms");
+	size_t count = background.graph.nodes.size();
+	for (unsigned int i = 0; i < objs.size(); i++)
+		count += objs[i].graph.nodes.size();
+
+	transforms.beginFrame(count);
+	background.pushTransforms(transforms);
+	for (unsigned int i = 0; i < objs.size(); i++)
+		objs[i].pushTransforms(transforms);
+	transforms.endWrites();
+}
+
+// lays down the depth of the opaque geometry from the position-only streams
+void render_depth(Shader &depthShader, Model &background, mat4 projection, mat4 view)
+{
+	PROFILE_SCOPE("render_depth");
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	depthShader.use();
+	depthShader.setMat4("projection", projection);
+	depthShader.setMat4("view", view);
+
+	Frustum frustum(projection * view);
+	background.DrawDepth(frustum, transforms);
+
+	for (unsigned int k = 0; k < visibleObjs.size(); k++) {
+		int i = visibleObjs[k];
+		objs[i].DrawDepth(frustum, transforms, visibleLods[k]);
+	}
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+// rasterizes the background and the objects marked as occluder into the occlusion buffer
+void render_occluders(Model &background, mat4 projection, mat4 view)
+{
+	PROFILE_CPU_SCOPE("render_occluders");
+	occlusion.begin(projection * view);
+
+	vector<Model*> occluders;
+	occluders.push_back(&background);
+	for (unsigned int i = 0; i < objs.size(); i++) {
+		if (objs[i].occluder)
+			occluders.push_back(&objs[i]);
+	}
+
+	for (unsigned int i = 0; i < occluders.size(); i++) {
+		for (unsigned int j = 0; j < occluders[i]->meshes.size(); j++) {
+			Mesh &mesh = occluders[i]->meshes[j];
+			if (mesh.vertices.empty() || mesh.indices.empty())
+				continue;
+			occlusion.addOccluder(occluders[i]->meshMatrix(j), &mesh.vertices[0].Position, sizeof(Vertex), mesh.vertices.size(),
+				&mesh.indices[0], mesh.indices.size());
+		}
+	}
+
+	occlusion.rasterize();
+}
+
+//after obj_pos, rotate or scale of an object changed: its bounds,
+//its leaf of the scene index and the shadow cube follow, in O(log n)
+void object_moved(int object)
+{
+	BoundingSphere before = objs[object].world_sphere;
+	objs[object].updateBounds();
+	shadows.objectMoved(before, objs[object].world_sphere);
+	sceneIndex.objectMoved(objs, object);
+	redraw = true;
 }
 
 void press_key(GLFWwindow* window, int key, int scancode, int action, int mods) {
-	if (key == GLFW_KEY_ESCAPE && action != GLFW_RELEASE)exit(0);
+	if (key == GLFW_KEY_ESCAPE && action != GLFW_RELEASE)glfwSetWindowShouldClose(window, true);
 
 	else if (key == GLFW_KEY_W && action != GLFW_RELEASE) {
 		lefteye.x += (left_viewat.x - lefteye.x)*speed;
@@ -361,13 +1353,72 @@ void press_key(GLFWwindow* window, int key, int scancode, int action, int mods)
 	else if (key == GLFW_KEY_M && action == GLFW_PRESS) {
 		changelight = !changelight;
 	}
+	else if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		occlusionCulling = !occlusionCulling;
+	}
+	else if (key == GLFW_KEY_L && action == GLFW_PRESS) {
+		useLod = !useLod;
+	}
+	else if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+		depthPrepass = !depthPrepass;
+	}
+	else if (key == GLFW_KEY_H && action == GLFW_PRESS) {
+		useShadows = !useShadows;
+	}
+	else if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		dynamicResolution.enabled = !dynamicResolution.enabled;
+		cout << "* dynamic resolution " << (dynamicResolution.enabled ? "on" : "off") << ", budget "
+			<< dynamicResolution.budgetMs << " ms" << endl;
+	}
+	else if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+		const char *names[] = { "off", "screen centre", "cursor" };
+		foveaMode = (foveaMode + 1) % 3;
+		cout << "* foveation: " << names[foveaMode] << endl;
+	}
+	else if (key == GLFW_KEY_X && action == GLFW_PRESS) {
+		memoryTracker().report(cout);
+		return;
+	}
+	else if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+		showStats = !showStats;
+	}
+	else if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		if (renderStats().recording())
+			renderStats().stopCsv();
+		else if (renderStats().startCsv("stats.csv"))
+			cout << "* stats: recording to stats.csv" << endl;
+		return;
+	}
+#ifdef PROFILER
+	else if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+		PROFILE_REPORT(cout);
+		return;
+	}
+#endif
+#ifdef TRACING
+	else if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+		TRACE_DUMP();
+		return;
+	}
+#endif
+#ifdef GL_CALLS
+	else if (key == GLFW_KEY_J && action == GLFW_PRESS) {
+		GL_CALLS_REPORT(cout);
+		return;
+	}
+	else if (key == GLFW_KEY_U && action == GLFW_PRESS) {
+		GL_CALLS_CAPTURE("glcalls.txt");
+	}
+#endif
+	else if (key == GLFW_KEY_R && action == GLFW_PRESS) {
+		const char *names[] = { "off", "holes rendered again", "holes filled" };
+		reprojectMode = (reprojectMode + 1) % 3;
+		cout << "* reprojection: " << names[reprojectMode] << endl;
+	}
 	else if (key == GLFW_KEY_B && action != GLFW_RELEASE) {
-		if (selectMode && !movelight) {
-			for (int i = 0; i < objs.size(); i++) {
-				if (objs[i].obj_choosen == true) {
-					objs[i].rotate.x += 0.05;
-				}
-			}
+		if (selectMode && !movelight && pickedObject != -1) {
+			objs[pickedObject].rotate.x += 0.05;
+			object_moved(pickedObject);
 		}
 	}
 	else if (key == GLFW_KEY_N && action == GLFW_PRESS) {
@@ -380,6 +1431,9 @@ void press_key(GLFWwindow* window, int key, int scancode, int action, int mods)
 		selectMode = !selectMode;
 		firstRenderMouse = !firstRenderMouse;
 	}
+	else return;
+	redraw = true;
+
 	righteye = lefteye + delta;
 
 
@@ -395,6 +1449,7 @@ void click_mouse(GLFWwindow* window, int button, int action, int mods)
 	if (!selectMode) {
 		return;
 	}
+	redraw = true;
 
 	double mouseX, mouseY;
 	glfwGetCursorPos(window, &mouseX, &mouseY);
@@ -421,39 +1476,38 @@ void click_mouse(GLFWwindow* window, int button, int action, int mods)
 		y = 1.0f - 2.0f * mouseY / SCR_HEIGHT;
 	}
 
-	double minDis = 0.1;
-	static int minIndex = -1;
-	for (int i = 0; i < objs.size() ; i++) {
-		vec4 pos = projection * view * translate(mat4(1.0f), objs[i].obj_pos) * vec4(0.0, 0.0, 0.0, 1.0);
-		double dis = (pos.x / pos.w - x) * (pos.x / pos.w - x)
-			+ (pos.y / pos.w - y) * (pos.y / pos.w - y);
-
-		dis = dis / objs[i].scale[0];
-
-		if (abs(dis) < minDis) {
-			minDis = abs(dis);
-			minIndex = i;
+	if (action == GLFW_RELEASE) {
+		if (pickedObject != -1) {
+			objs[pickedObject].obj_choosen = false;
+			cout << objs[pickedObject].obj_pos.x << objs[pickedObject].obj_pos.y << objs[pickedObject].obj_pos.z << endl;
 		}
+		movelight = false;
+		pickedObject = -1;
+		return;
 	}
 
-	vec4 pos = projection * view * translate(mat4(1.0f), light_pos) * vec4(0.0, 0.0, 0.0, 1.0);
-	double dis = (pos.x / pos.w - x) * (pos.x / pos.w - x)
-		+ (pos.y / pos.w - y) * (pos.y / pos.w - y);
-	if (abs(dis) < minDis) {
-		minDis = abs(dis);
-		movelight = true;
+	// the nearest triangle under the cursor, of an object or of the lamp in front of it
+	Ray ray = viewRay(inverse(projection * view), vec2(x, y));
+	PickHit hit;
+	float nearest = ray.tMax;
+	if (sceneIndex.pick(ray, objs, hit)) {
+		pickedObject = hit.object;
+		nearest = hit.t;
 	}
-	if (minIndex != -1 && !movelight ) {
-		objs[minIndex].obj_choosen = true;
-	}
-	if (action == GLFW_RELEASE && (minIndex != -1 || movelight == true)) {
-		if (minIndex != -1) {
-			objs[minIndex].obj_choosen = false;
-			cout << objs[minIndex].obj_pos.x << objs[minIndex].obj_pos.y << objs[minIndex].obj_pos.z << endl;
-		}
 
-		movelight = false;
-		minIndex = -1;
+	if (lampModel) {
+		// the pick BVH is in the object space Model::Draw places at lamp_transform
+		mat4 lampTransfor = lamp_transform(light_pos);
+		RayHit lampHit;
+		lampHit.t = nearest;
+		int mesh;
+		if (lampModel->raycast(ray, inverse(lampTransfor), lampHit, mesh)) {
+			movelight = true;
+			pickedObject = -1;
+		}
+	}
+	if (pickedObject != -1) {
+		objs[pickedObject].obj_choosen = true;
 	}
 
 	return;
@@ -461,6 +1515,9 @@ void click_mouse(GLFWwindow* window, int button, int action, int mods)
 
 void move_mouse(GLFWwindow* window, double xpos, double ypos)
 {
+	cursorPosition = vec2(xpos, ypos);
+	if (foveaMode == FOVEA_CURSOR && selectMode)
+		redraw = true;
 
 	static float lastXpos, lastYpos;//for drag
 
@@ -485,15 +1542,14 @@ void move_mouse(GLFWwindow* window, double xpos, double ypos)
 		if (movelight) {
 			vec3 offset(-(left_viewat.z - lefteye.z)* xoffset, yoffset/5, (left_viewat.x - lefteye.x)* xoffset);
 			light_pos += offset;
+			redraw = true;
 			return;
 		}
 
-		for (int i = 0; i < objs.size(); i++) {
-			if (objs[i].obj_choosen == true) {
-				vec3 offset(-(left_viewat.z - lefteye.z)* xoffset, yoffset/5, (left_viewat.x - lefteye.x)* xoffset);
-				objs[i].obj_pos += offset;
-				break;
-			}
+		if (pickedObject != -1) {
+			vec3 offset(-(left_viewat.z - lefteye.z)* xoffset, yoffset/5, (left_viewat.x - lefteye.x)* xoffset);
+			objs[pickedObject].obj_pos += offset;
+			object_moved(pickedObject);
 		}
 	}
 	
@@ -516,6 +1572,7 @@ void move_mouse(GLFWwindow* window, double xpos, double ypos)
 		left_viewat.y = float(lefteye.y + viewUp);
 
 		right_viewat = left_viewat;
+		redraw = true;
 	}
 	return;
 }
@@ -532,6 +1589,7 @@ void scroll(GLFWwindow* window, double x, double y) {
 		if (std::min(std::min(diffuse.x, diffuse.y), diffuse.z) <= 0.05) diffuse = vec3(0.05, 0.05, 0.05);
 		if (std::max(std::max(diffuse.x, diffuse.y), diffuse.z) >= 0.95) diffuse = vec3(0.95, 0.95, 0.95);
 
+		redraw = true;
 	}
 }
 
@@ -539,4 +1597,11 @@ void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
 	SCR_WIDTH = width;
 	SCR_HEIGHT = height;
+	redraw = true;
+}
+
+//the window system lost the contents (uncovered, restored)
+void refresh_window(GLFWwindow* window)
+{
+	redraw = true;
 }
\ No newline at end of file
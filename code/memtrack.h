@@ -0,0 +1,260 @@
+#ifndef MEMTRACK_H
+#define MEMTRACK_H
+
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+
+enum MemoryCategory {
+	MEM_CPU_GEOMETRY,		// vertices and indices kept by the meshes
+	MEM_CPU_MODEL,			// per model copies: positions, the pick BVH
+	MEM_CPU_TEXTURE,		// textures decoded for the CPU renderers
+	MEM_GPU_GEOMETRY,		// vertex and element buffers
+	MEM_GPU_TEXTURE,		// material textures with their mip chains
+	MEM_GPU_TARGET,			// render targets and the shadow cube
+	MEM_GPU_STREAM,			// buffers rewritten every frame: transforms, light clusters, readback
+	MEM_CATEGORIES
+};
+
+/*
+	Bytes held per resource category and per owner (a model's path, or a
+	renderer part like "shadow cube"), to budget a scene before it ships.
+	The GPU sizes are estimates made when the data is uploaded: the bytes
+	asked for, RGB textures padded to four bytes a texel and mips counted;
+	the driver's own overhead and alignment are not known here. Owners
+	hold a MemoryAccount and set what they hold per category; the tracker
+	keeps the totals, the peak of every category and the accounts for the
+	largest consumers. Any thread may charge, it takes a lock.
+*/
+class MemoryTracker {
+public:
+	size_t budget[2];		// CPU and GPU bytes checkBudget warns above, 0 for none
+
+	MemoryTracker() : nextId(1)
+	{
+		budget[0] = budget[1] = 0;
+		for (int i = 0; i < MEM_CATEGORIES; i++)
+			totals[i] = peaks[i] = 0;
+	}
+
+	MemoryTracker(const MemoryTracker &) = delete;
+	MemoryTracker &operator=(const MemoryTracker &) = delete;
+
+	static const char *categoryName(int category)
+	{
+		const char *names[MEM_CATEGORIES] = { "cpu geometry", "cpu model", "cpu texture",
+			"gpu geometry", "gpu texture", "gpu target", "gpu stream" };
+		return names[category];
+	}
+
+	static bool onGpu(int category) { return category >= MEM_GPU_GEOMETRY; }
+
+	// by MemoryAccount
+	int open(const string &owner)
+	{
+		lock_guard<mutex> lock(guard);
+		Account &account = accounts[nextId];
+		account.owner = owner;
+		return nextId++;
+	}
+
+	void close(int id)
+	{
+		lock_guard<mutex> lock(guard);
+		map<int, Account>::iterator found = accounts.find(id);
+		if (found == accounts.end())
+			return;
+		for (int i = 0; i < MEM_CATEGORIES; i++)
+			totals[i] -= found->second.bytes[i];
+		accounts.erase(found);
+	}
+
+	void rename(int id, const string &owner)
+	{
+		lock_guard<mutex> lock(guard);
+		accounts[id].owner = owner;
+	}
+
+	void set(int id, int category, size_t bytes)
+	{
+		lock_guard<mutex> lock(guard);
+		size_t &held = accounts[id].bytes[category];
+		totals[category] += bytes - held;
+		held = bytes;
+		peaks[category] = std::max(peaks[category], totals[category]);
+	}
+
+	size_t total(int category) const
+	{
+		lock_guard<mutex> lock(guard);
+		return totals[category];
+	}
+
+	// all CPU (gpu false) or GPU categories
+	size_t totalOn(bool gpu) const
+	{
+		lock_guard<mutex> lock(guard);
+		size_t sum = 0;
+		for (int i = 0; i < MEM_CATEGORIES; i++)
+			if (onGpu(i) == gpu)
+				sum += totals[i];
+		return sum;
+	}
+
+	// totals and peaks per category, then the top owners; accounts of the same owner are summed
+	void report(ostream &out, int top = 10) const
+	{
+		lock_guard<mutex> lock(guard);
+		map<string, Account> owners;
+		for (map<int, Account>::const_iterator i = accounts.begin(); i != accounts.end(); i++) {
+			Account &owner = owners[i->second.owner];
+			for (int c = 0; c < MEM_CATEGORIES; c++)
+				owner.bytes[c] += i->second.bytes[c];
+		}
+		vector<pair<size_t, string>> order;
+		for (map<string, Account>::const_iterator i = owners.begin(); i != owners.end(); i++)
+			if (i->second.sum() > 0)
+				order.push_back(make_pair(i->second.sum(), i->first));
+		sort(order.rbegin(), order.rend());
+
+		size_t cpu = 0, gpu = 0;
+		for (int i = 0; i < MEM_CATEGORIES; i++)
+			(onGpu(i) ? gpu : cpu) += totals[i];
+		out << fixed << setprecision(2);
+		out << "* memory: " << mb(cpu) << " MB CPU, " << mb(gpu) << " MB GPU (estimated), MB now / peak" << endl;
+		for (int i = 0; i < MEM_CATEGORIES; i++)
+			out << "  " << left << setw(14) << categoryName(i) << right << setw(10) << mb(totals[i]) << setw(10) << mb(peaks[i]) << endl;
+		out << "  top " << std::min((int)order.size(), top) << " of " << order.size() << " owners:" << endl;
+		for (int i = 0; i < (int)order.size() && i < top; i++) {
+			const Account &owner = owners[order[i].second];
+			out << "  " << setw(10) << mb(order[i].first) << "  " << order[i].second << " (";
+			bool first = true;
+			for (int c = 0; c < MEM_CATEGORIES; c++) {
+				if (!owner.bytes[c])
+					continue;
+				out << (first ? "" : ", ") << categoryName(c) << " " << mb(owner.bytes[c]);
+				first = false;
+			}
+			out << ")" << endl;
+		}
+		out.unsetf(ios::floatfield);
+		out << setprecision(6);
+	}
+
+	// warns about the CPU and GPU totals over budget, returns whether both fit
+	bool checkBudget(ostream &out) const
+	{
+		bool fits = true;
+		for (int gpu = 0; gpu < 2; gpu++) {
+			size_t used = totalOn(gpu != 0);
+			if (budget[gpu] && used > budget[gpu]) {
+				out << fixed << setprecision(2) << "WARNING::MEMORY:: " << mb(used) << " MB " << (gpu ? "GPU" : "CPU")
+					<< " over the budget of " << mb(budget[gpu]) << " MB" << endl;
+				out.unsetf(ios::floatfield);
+				out << setprecision(6);
+				fits = false;
+			}
+		}
+		return fits;
+	}
+
+	static double mb(size_t bytes) { return bytes / (1024.0 * 1024.0); }
+
+private:
+	struct Account {
+		string owner;
+		size_t bytes[MEM_CATEGORIES];
+		Account() { for (int i = 0; i < MEM_CATEGORIES; i++) bytes[i] = 0; }
+		size_t sum() const
+		{
+			size_t total = 0;
+			for (int i = 0; i < MEM_CATEGORIES; i++)
+				total += bytes[i];
+			return total;
+		}
+	};
+
+	mutable mutex guard;
+	map<int, Account> accounts;
+	int nextId;
+	size_t totals[MEM_CATEGORIES], peaks[MEM_CATEGORIES];
+};
+
+// never destroyed: the global renderer parts close their accounts at exit, in any order
+inline MemoryTracker &memoryTracker()
+{
+	static MemoryTracker *instance = new MemoryTracker();
+	return *instance;
+}
+
+// what one owner holds; registered with the tracker on the first charge, closed with the owner; moves but never copies
+class MemoryAccount {
+public:
+	MemoryAccount(const string &owner = "") : owner(owner), id(0) {}
+	MemoryAccount(const MemoryAccount &) = delete;
+	MemoryAccount &operator=(const MemoryAccount &) = delete;
+	MemoryAccount(MemoryAccount &&other) noexcept : owner(std::move(other.owner)), id(other.id) { other.id = 0; }
+	MemoryAccount &operator=(MemoryAccount &&other) noexcept
+	{
+		if (this != &other) {
+			clear();
+			owner = std::move(other.owner);
+			id = other.id;
+			other.id = 0;
+		}
+		return *this;
+	}
+	~MemoryAccount() { clear(); }
+
+	void rename(const string &name)
+	{
+		owner = name;
+		if (id)
+			memoryTracker().rename(id, owner);
+	}
+
+	// the owner now holds bytes in category, instead of what it held there before
+	void set(int category, size_t bytes)
+	{
+		if (!id) {
+			if (!bytes)
+				return;
+			id = memoryTracker().open(owner);
+		}
+		memoryTracker().set(id, category, bytes);
+	}
+
+	// everything released
+	void clear()
+	{
+		if (id)
+			memoryTracker().close(id);
+		id = 0;
+	}
+
+private:
+	string owner;
+	int id;
+};
+
+// a 2D texture with its full mip chain, bytesPerTexel per level
+inline size_t textureBytes(int width, int height, int bytesPerTexel, bool mips)
+{
+	size_t bytes = 0;
+	while (width > 0 && height > 0) {
+		bytes += (size_t)width * height * bytesPerTexel;
+		if (!mips || (width == 1 && height == 1))
+			break;
+		width = std::max(width / 2, 1);
+		height = std::max(height / 2, 1);
+	}
+	return bytes;
+}
+
+#endif
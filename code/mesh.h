@@ -5,12 +5,14 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "culling.h"
 
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <utility>
 using namespace std;
 
 /*
@@ -37,6 +39,16 @@ struct Texture {
 	string path;
 };
 
+// cleared by the CPU renderers before anything is loaded: meshes then keep their data in
+// memory only and textures are decoded for the CPU (see TextureFromFile), no GL call is made
+bool uploadToGL = true;
+
+// a range of the element buffer holding one level of detail
+struct LodLevel {
+	unsigned int offset;	// in indices
+	unsigned int count;
+};
+
 class Mesh {
 public:
 	/*  Mesh Data  */
@@ -44,21 +56,72 @@ public:
 	vector<unsigned int> indices;
 	vector<Texture> textures;
 	unsigned int VAO;
+	unsigned int depthVAO;	// position-only stream for the depth pre-pass
+	AABB bounds;		// model space bounding box of the vertices
+	vector<LodLevel> lods;	// lods[0] is indices itself, coarser levels follow
 
 	/*  Functions  */
-	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	// constructor, lodIndices are optional coarser index buffers over the same vertices
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures,
+		vector<vector<unsigned int>> lodIndices = vector<vector<unsigned int>>())
 	{
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->textures = std::move(textures);
+
+		for (unsigned int i = 0; i < this->vertices.size(); i++)
+			bounds.expand(this->vertices[i].Position);
+
+		// all levels of detail share one element buffer
+		LodLevel full = { 0, (unsigned int)this->indices.size() };
+		lods.push_back(full);
+		for (unsigned int i = 0; i < lodIndices.size(); i++) {
+			LodLevel level = { lods.back().offset + lods.back().count, (unsigned int)lodIndices[i].size() };
+			lods.push_back(level);
+		}
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
-		setupMesh();
+		VAO = depthVAO = VBO = EBO = positionVBO = 0;
+		if (uploadToGL)
+			setupMesh(lodIndices);
+	}
+
+	// the GL objects belong to exactly one Mesh: it can be moved, not copied, and deletes them
+	// (the textures are shared between meshes and belong to the Model)
+	Mesh(const Mesh &) = delete;
+	Mesh &operator=(const Mesh &) = delete;
+
+	Mesh(Mesh &&other) noexcept
+		: vertices(std::move(other.vertices)), indices(std::move(other.indices)), textures(std::move(other.textures)),
+		VAO(other.VAO), depthVAO(other.depthVAO), bounds(other.bounds), lods(std::move(other.lods)),
+		VBO(other.VBO), EBO(other.EBO), positionVBO(other.positionVBO)
+	{
+		other.VAO = other.depthVAO = other.VBO = other.EBO = other.positionVBO = 0;
+	}
+
+	Mesh &operator=(Mesh &&other) noexcept
+	{
+		if (this != &other) {
+			release();
+			vertices = std::move(other.vertices);
+			indices = std::move(other.indices);
+			textures = std::move(other.textures);
+			VAO = other.VAO; depthVAO = other.depthVAO;
+			bounds = other.bounds;
+			lods = std::move(other.lods);
+			VBO = other.VBO; EBO = other.EBO; positionVBO = other.positionVBO;
+			other.VAO = other.depthVAO = other.VBO = other.EBO = other.positionVBO = 0;
+		}
+		return *this;
+	}
+
+	~Mesh()
+	{
+		release();
 	}
 
 	// render the mesh
-	void Draw(Shader shader)
+	void Draw(const Shader &shader, int lod = 0)
 	{
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
@@ -88,20 +151,72 @@ public:
 
 		// draw mesh
 		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+		lod = std::min(std::max(lod, 0), (int)lods.size() - 1);
+		glDrawElements(GL_TRIANGLES, lods[lod].count, GL_UNSIGNED_INT, (void*)(lods[lod].offset * sizeof(unsigned int)));
 		glBindVertexArray(0);
+		count(lods[lod].count, (unsigned int)textures.size());
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
+	// depth only: no textures, tightly packed positions instead of the interleaved vertex
+	void DrawDepth(int lod = 0)
+	{
+		glBindVertexArray(depthVAO);
+		lod = std::min(std::max(lod, 0), (int)lods.size() - 1);
+		glDrawElements(GL_TRIANGLES, lods[lod].count, GL_UNSIGNED_INT, (void*)(lods[lod].offset * sizeof(unsigned int)));
+		glBindVertexArray(0);
+		count(lods[lod].count, 0);
+	}
+
+	// the vertices and indices kept in memory
+	size_t cpuBytes() const
+	{
+		return vertices.capacity() * sizeof(Vertex) + indices.capacity() * sizeof(unsigned int);
+	}
+
+	// what setupMesh uploaded: the interleaved vertices, the positions and the indices of every level
+	size_t gpuBytes() const
+	{
+		if (!VAO)
+			return 0;
+		return vertices.size() * (sizeof(Vertex) + sizeof(glm::vec3)) + (lods.back().offset + lods.back().count) * sizeof(unsigned int);
+	}
+
 private:
 	/*  Render data  */
 	unsigned int VBO, EBO;
+	unsigned int positionVBO;
 
 	/*  Functions    */
+	// one draw of count indices with textureCount textures bound (stats.h)
+	static void count(unsigned int indices, unsigned int textureCount)
+	{
+		RenderCounters &counters = renderCounters();
+		counters.textureBinds += textureCount;
+		counters.uniformUpdates += textureCount;
+		counters.vaoBinds++;
+		counters.drawCalls++;
+		counters.triangles += indices / 3;
+	}
+
+	void release()
+	{
+		if (VAO)
+			glDeleteVertexArrays(1, &VAO);
+		if (depthVAO)
+			glDeleteVertexArrays(1, &depthVAO);
+		unsigned int buffers[3] = { VBO, EBO, positionVBO };
+		for (int i = 0; i < 3; i++) {
+			if (buffers[i])
+				glDeleteBuffers(1, &buffers[i]);
+		}
+		VAO = depthVAO = VBO = EBO = positionVBO = 0;
+	}
+
 	// initializes all the buffer objects/arrays
-	void setupMesh()
+	void setupMesh(const vector<vector<unsigned int>> &lodIndices)
 	{
 		// create buffers/arrays
 		glGenVertexArrays(1, &VAO);
@@ -115,7 +230,10 @@ private:
 		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
 
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, (lods.back().offset + lods.back().count) * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(unsigned int), &indices[0]);
+		for (unsigned int i = 0; i < lodIndices.size(); i++)
+			glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, lods[i + 1].offset * sizeof(unsigned int), lodIndices[i].size() * sizeof(unsigned int), &lodIndices[i][0]);
 
 		// set the vertex attribute pointers
 		// vertex Positions
@@ -135,6 +253,22 @@ private:
 		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
 
 		glBindVertexArray(0);
+
+		// 12 byte positions for the depth pre-pass, sharing the element buffer
+		vector<glm::vec3> positions(vertices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++)
+			positions[i] = vertices[i].Position;
+
+		glGenVertexArrays(1, &depthVAO);
+		glGenBuffers(1, &positionVBO);
+		glBindVertexArray(depthVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), &positions[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+		glBindVertexArray(0);
 	}
 };
 #endif
\ No newline at end of file
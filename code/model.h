@@ -11,6 +11,13 @@
 
 #include "mesh.h"
 #include "shader.h"
+#include "culling.h"
+#include "simplify.h"
+#include "scenegraph.h"
+#include "bvh.h"
+#include "transforms.h"
+#include "trace.h"
+#include "memtrack.h"
 
 #include <string>
 #include <fstream>
@@ -23,7 +30,7 @@
 using namespace std;
 using namespace glm;
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false, size_t *bytes = NULL);
 float AngleToRadion = 3.14159 / 180.0;
 void Swap(float *a, int i, int j) {
 	float temp = a[i];
@@ -51,12 +58,51 @@ void randqsort(float *a, int begin, int n) {
 	randqsort(a, m + 1, n);
 }
 
-unsigned int TextureFromFile(const char *path, const string &directory, bool gamma)
+// texels of a texture for the CPU renderers, always four channels, first row at v = 0
+struct TextureImage {
+	int width, height;
+	vector<unsigned char> rgba;
+};
+
+// every texture loaded while uploadToGL is off; Texture::id is then the index + 1, 0 if it failed
+inline vector<TextureImage> &cpuTextures()
+{
+	static vector<TextureImage> images;
+	return images;
+}
+
+inline const TextureImage *cpuTexture(unsigned int id)
+{
+	if (id == 0 || id > cpuTextures().size())
+		return NULL;
+	return &cpuTextures()[id - 1];
+}
+
+// bytes, when given, gets what the texture takes: the estimated GPU size with its mips, or the decoded CPU copy
+unsigned int TextureFromFile(const char *path, const string &directory, bool gamma, size_t *bytes)
 {
+	TRACE_SCOPE_DETAIL("TextureFromFile", path);
 
 	string filename = string(path);
 	filename = directory + '/' + filename;
 
+	if (!uploadToGL)
+	{
+		TextureImage image;
+		unsigned char *data = stbi_load(filename.c_str(), &image.width, &image.height, NULL, 4);
+		if (!data)
+		{
+			std::cout << "Texture failed to load at path: " << path << std::endl;
+			return 0;
+		}
+		image.rgba.assign(data, data + (size_t)image.width * image.height * 4);
+		stbi_image_free(data);
+		if (bytes)
+			*bytes = image.rgba.size();
+		cpuTextures().push_back(std::move(image));
+		return (unsigned int)cpuTextures().size();
+	}
+
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
@@ -76,6 +122,9 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 		glBindTexture(GL_TEXTURE_2D, textureID);
 		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
 		glGenerateMipmap(GL_TEXTURE_2D);
+		// drivers keep RGB as RGBA
+		if (bytes)
+			*bytes = textureBytes(width, height, nrComponents == 3 ? 4 : nrComponents, true);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -93,6 +142,38 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
 	return textureID;
 }
 
+// owns the textures loaded for one model, deletes them with it; moves but never copies
+class OwnedTextures
+{
+public:
+	OwnedTextures() {}
+	OwnedTextures(const OwnedTextures &) = delete;
+	OwnedTextures &operator=(const OwnedTextures &) = delete;
+	OwnedTextures(OwnedTextures &&other) noexcept : ids(std::move(other.ids)) { other.ids.clear(); }
+	OwnedTextures &operator=(OwnedTextures &&other) noexcept
+	{
+		if (this != &other) {
+			release();
+			ids = std::move(other.ids);
+			other.ids.clear();
+		}
+		return *this;
+	}
+	~OwnedTextures() { release(); }
+
+	void add(unsigned int id) { ids.push_back(id); }
+
+private:
+	vector<unsigned int> ids;
+
+	void release()
+	{
+		if (!ids.empty())
+			glDeleteTextures((GLsizei)ids.size(), &ids[0]);
+		ids.clear();
+	}
+};
+
 class Model
 {
 public:
@@ -104,9 +185,21 @@ public:
 	int size;
 
 	bool obj_choosen;
+	bool occluder;		// rasterized into the software occlusion buffer
+	int transform_slot;	// first of this frame's slots in the TransformRing, one per graph node
 	vec3 obj_pos;
 	vec4 rotate;
 	vec3 scale;
+
+	// bounding volumes: local_bounds is computed at load, the world ones by updateBounds()
+	AABB local_bounds;
+	AABB world_bounds;
+	BoundingSphere world_sphere;
+	SphereSet mesh_spheres;		// world space sphere of every mesh, culled in one batch by Draw
+
+	// node hierarchy of the file under an object root holding obj_pos/rotate/scale
+	SceneGraph graph;
+	vector<int> mesh_node;		// graph node of every mesh
 	
 	GLint v_num;
 	vector<vec3> vertex;
@@ -118,6 +211,64 @@ public:
 		this->obj_pos = obj_pos;
 		this->rotate = rotate;
 		this->scale = scale;
+		updateBounds();
+	}
+
+	mat4 modelMatrix() const
+	{
+		mat4 model = mat4(1.0f);
+		model = glm::translate(model, obj_pos);
+		if (rotate.y != 0 || rotate.z != 0 || rotate.w != 0)
+			model = glm::rotate(model, rotate.x, vec3(rotate.y, rotate.z, rotate.w));
+		model = glm::scale(model, scale);
+		return model;
+	}
+
+	// world matrix of a mesh, the object transform times its node's transforms
+	const mat4 &meshMatrix(int i) const
+	{
+		return graph.world(mesh_node[i]);
+	}
+
+	// the node transforms of a mesh alone, in the object space of local_bounds and the pick BVH
+	mat4 meshObjectMatrix(int i) const
+	{
+		return inverse(graph.world(0)) * meshMatrix(i);
+	}
+
+	// must be called whenever obj_pos, rotate or scale change
+	void updateBounds()
+	{
+		graph.setLocal(0, modelMatrix());
+		refreshBounds();
+	}
+
+	// nearest triangle hit by a world space ray before hit.t, through the object transform
+	bool raycast(const Ray &ray, RayHit &hit, int &mesh) const
+	{
+		return raycast(ray, inverse(graph.world(0)), hit, mesh);
+	}
+
+	// the same with the model drawn at a transform of its own, given inverted;
+	// hit.triangle is the index within the mesh
+	bool raycast(const Ray &ray, const mat4 &inverseTransform, RayHit &hit, int &mesh) const
+	{
+		if (!pick_bvh.intersect(transformRay(ray, inverseTransform), hit))
+			return false;
+		mesh = int(std::upper_bound(pick_first.begin(), pick_first.end(), hit.triangle) - pick_first.begin()) - 1;
+		hit.triangle -= pick_first[mesh];
+		return true;
+	}
+
+	// writes the matrices of every node into the ring, Draw binds them per mesh
+	void pushTransforms(TransformRing &transforms)
+	{
+		transform_slot = -1;
+		for (unsigned int i = 0; i < graph.nodes.size(); i++) {
+			int slot = transforms.push(graph.nodes[i].world, graph.nodes[i].normal);
+			if (i == 0)
+				transform_slot = slot;
+		}
 	}
 
 	/*  Functions   */
@@ -125,22 +276,177 @@ public:
 	Model(string const &path, bool gamma = false) 
 	{
 		obj_choosen = false;
+		occluder = false;
+		transform_slot = -1;
+		obj_pos = vec3(0.0f);
+		rotate = vec4(0.0f);
+		scale = vec3(1.0f);
+		texture_bytes = 0;
+		memory.rename(path);
+		graph.add(path, mat4(1.0f), -1);
 		loadModel(path);
+		// the object root is still identity here, so these are object space
+		graph.update();
+		for (unsigned int i = 0; i < meshes.size(); i++)
+			local_bounds.expand(transformAABB(meshes[i].bounds, meshMatrix(i)));
+		buildPickBVH();
+		updateBounds();
+		accountMemory();
 		//getCenter();
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
+	// meshes and textures are GPU resources, a model is moved around but never copied
+	Model(const Model &) = delete;
+	Model &operator=(const Model &) = delete;
+	Model(Model &&) = default;
+	Model &operator=(Model &&) = default;
+
+	// draws all meshes for a model placed by a matrix of its own instead of obj_pos (the lamp, the sky):
+	// the "model" uniform of each is transform times its node transforms
+	void Draw(const Shader &shader, const mat4 &transform)
 	{
-		for (unsigned int i = 0; i < meshes.size(); i++)
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			shader.setMat4("model", transform * meshObjectMatrix(i));
 			meshes[i].Draw(shader);
+		}
+	}
+
+	// draws only the meshes whose world bounding sphere intersects the frustum,
+	// with the transforms written by pushTransforms
+	void Draw(const Shader &shader, const Frustum &frustum, const TransformRing &transforms, int lod = 0)
+	{
+		cullSpheres(frustum, mesh_spheres, mesh_visible);
+		int bound = -1;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!mesh_visible[i]) {
+				renderCounters().meshesCulled++;
+				continue;
+			}
+			bindNode(transforms, mesh_node[i], bound);
+			meshes[i].Draw(shader, lod);
+		}
+	}
+
+	// every mesh, for views that are not a single frustum (the shadow cube)
+	void DrawDepth(const TransformRing &transforms, int lod = 0)
+	{
+		int bound = -1;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			bindNode(transforms, mesh_node[i], bound);
+			meshes[i].DrawDepth(lod);
+		}
+	}
+
+	// depth pre-pass counterpart of Draw, must be given the same frustum and lod
+	void DrawDepth(const Frustum &frustum, const TransformRing &transforms, int lod = 0)
+	{
+		cullSpheres(frustum, mesh_spheres, mesh_visible);
+		int bound = -1;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			if (!mesh_visible[i])
+				continue;
+			bindNode(transforms, mesh_node[i], bound);
+			meshes[i].DrawDepth(lod);
+		}
+	}
+
+	// level of detail from the projected size of the bounding sphere
+	int lodFor(const vec3 &eye, const mat4 &projection) const
+	{
+		float distance = length(world_sphere.center - eye);
+		if (distance <= world_sphere.radius)
+			return 0;
+		// projected radius as a fraction of the viewport height
+		float size = world_sphere.radius * projection[1][1] / distance;
+		int lod = 0;
+		for (float threshold = 0.25f; size < threshold && lod + 1 < LOD_COUNT; threshold *= 0.5f)
+			lod++;
+		return lod;
 	}
 
 private:
+	vector<unsigned char> mesh_visible;
+	OwnedTextures owned_textures;
+	MemoryAccount memory;		// what the model holds, under its path (memtrack.h)
+	size_t texture_bytes;		// of its textures, on the GPU or decoded for the CPU renderers
+
+	// triangles of all meshes in object space for raycast, built at load
+	TriangleBVH pick_bvh;
+	vector<unsigned int> pick_first;	// first triangle of every mesh
+
+	// binds the node's slot unless it is the one bound last
+	void bindNode(const TransformRing &transforms, int node, int &bound) const
+	{
+		if (transform_slot < 0 || node == bound)
+			return;
+		transforms.bind(transform_slot + node);
+		bound = node;
+	}
+
+	// object space triangles of every mesh under the current node transforms
+	void buildPickBVH()
+	{
+		graph.update();
+		mat4 toObject = inverse(graph.world(0));
+		vector<vec3> positions;
+		vector<unsigned int> indices;
+		pick_first.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			pick_first.push_back((unsigned int)(indices.size() / 3));
+			mat4 matrix = toObject * meshMatrix(i);
+			unsigned int base = (unsigned int)positions.size();
+			for (unsigned int v = 0; v < meshes[i].vertices.size(); v++)
+				positions.push_back(vec3(matrix * vec4(meshes[i].vertices[v].Position, 1.0f)));
+			for (unsigned int k = 0; k < meshes[i].indices.size() / 3 * 3; k++)
+				indices.push_back(base + meshes[i].indices[k]);
+		}
+		pick_bvh.build(positions, indices);
+	}
+
+	// charges the meshes, textures and the model's own copies to its account
+	void accountMemory()
+	{
+		size_t cpu = 0, gpu = 0;
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			cpu += meshes[i].cpuBytes();
+			gpu += meshes[i].gpuBytes();
+		}
+		memory.set(MEM_CPU_GEOMETRY, cpu);
+		memory.set(MEM_GPU_GEOMETRY, gpu);
+		memory.set(uploadToGL ? MEM_GPU_TEXTURE : MEM_CPU_TEXTURE, texture_bytes);
+		memory.set(MEM_CPU_MODEL, vertex.capacity() * sizeof(vec3) + pick_bvh.bytes() + pick_first.capacity() * sizeof(unsigned int));
+	}
+
+	// world bounds from the current node matrices
+	void refreshBounds()
+	{
+		graph.update();
+		world_bounds = AABB();
+		mesh_spheres.clear();
+		for (unsigned int i = 0; i < meshes.size(); i++) {
+			AABB box = transformAABB(meshes[i].bounds, meshMatrix(i));
+			world_bounds.expand(box);
+			mesh_spheres.push(sphereOf(box));
+		}
+		if (!world_bounds.valid())
+			world_bounds = transformAABB(local_bounds, modelMatrix());
+		world_sphere = sphereOf(world_bounds);
+	}
+
+	static mat4 toMat4(const aiMatrix4x4 &m)
+	{
+		// assimp is row major, glm column major
+		return mat4(m.a1, m.b1, m.c1, m.d1,
+			m.a2, m.b2, m.c2, m.d2,
+			m.a3, m.b3, m.c3, m.d3,
+			m.a4, m.b4, m.c4, m.d4);
+	}
+
 	/*  Functions   */
 	// loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
 	void loadModel(string const &path)
 	{
+		TRACE_SCOPE_DETAIL("loadModel", path.c_str());
 		name = path;
 		// read file via ASSIMP
 		Assimp::Importer importer;
@@ -154,13 +460,16 @@ private:
 		// retrieve the directory path of the filepath
 		directory = path.substr(0, path.find_last_of('/'));
 
-		// process ASSIMP's root node recursively
-		processNode(scene->mRootNode, scene);
+		// process ASSIMP's root node recursively, below the object root
+		processNode(scene->mRootNode, scene, 0);
 	}
 
 	// processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-	void processNode(aiNode *node, const aiScene *scene)
+	void processNode(aiNode *node, const aiScene *scene, int parent)
 	{
+		// keep the node and its transform in the graph, depth first like the recursion
+		int index = graph.add(node->mName.C_Str(), toMat4(node->mTransformation), parent);
+
 		// process each mesh located at the current node
 		for (unsigned int i = 0; i < node->mNumMeshes; i++)
 		{
@@ -168,17 +477,19 @@ private:
 			// the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
 			aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
 			meshes.push_back(processMesh(mesh, scene));
+			mesh_node.push_back(index);
 		}
 		// after we've processed all of the meshes (if any) we then recursively process each of the children nodes
 		for (unsigned int i = 0; i < node->mNumChildren; i++)
 		{
-			processNode(node->mChildren[i], scene);
+			processNode(node->mChildren[i], scene, index);
 		}
 
 	}
 
 	Mesh processMesh(aiMesh *mesh, const aiScene *scene)
 	{
+		TRACE_SCOPE_DETAIL("processMesh", mesh->mName.C_Str());
 		// data to fill
 		vector<Vertex> vertices;
 		vector<unsigned int> indices;
@@ -255,8 +566,12 @@ private:
 			vertex.push_back(vertices[i].Position);
 		}
 		v_num = vertices.size();
-		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		// return a mesh object created from the extracted mesh data, with its simplified levels of detail
+		// (the CPU renderers draw the full meshes only)
+		vector<vector<unsigned int>> lods;
+		if (uploadToGL)
+			lods = buildLods(vertices, indices);
+		return Mesh(std::move(vertices), std::move(indices), std::move(textures), std::move(lods));
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -282,7 +597,11 @@ private:
 			if (!skip)
 			{   // if texture hasn't been loaded already, load it
 				Texture texture;
-				texture.id = TextureFromFile(str.C_Str(), this->directory);
+				size_t bytes = 0;
+				texture.id = TextureFromFile(str.C_Str(), this->directory, false, &bytes);
+				texture_bytes += bytes;
+				if (uploadToGL)
+					owned_textures.add(texture.id);
 				texture.type = typeName;
 				texture.path = str.C_Str();
 				textures.push_back(texture);
@@ -0,0 +1,292 @@
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include "culling.h"
+#include "threadpool.h"
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE 1
+#endif
+
+using namespace std;
+using namespace glm;
+
+/*
+	Software occlusion culling.
+	A few occluder meshes are rasterized depth-only into a small buffer on the
+	CPU, the buffer is reduced into a max-depth pyramid (hierarchical z), and
+	an object is culled when the nearest point of its screen-space bounds lies
+	behind every texel it covers. Depth is NDC z mapped to [0, 1].
+	Usage per view: begin(), addOccluder() for each occluder, rasterize(), then
+	visible() for every candidate.
+*/
+class OcclusionCuller {
+public:
+	static const int WIDTH = 256;		// multiple of 4 for the SIMD row loop
+	static const int HEIGHT = 128;
+	static const int BAND = 8;			// rows rasterized by one job
+
+	void begin(const mat4 &viewProjection)
+	{
+		this->viewProjection = viewProjection;
+		clipVerts.clear();
+		indices.clear();
+	}
+
+	// queues the triangles of one occluder, positions are taken as float[3] with the given stride
+	void addOccluder(const mat4 &model, const void *positions, size_t stride, size_t vertexCount,
+		const unsigned int *triangleIndices, size_t indexCount)
+	{
+		mat4 mvp = viewProjection * model;
+		unsigned int base = (unsigned int)clipVerts.size();
+		clipVerts.resize(base + vertexCount);
+
+		const int chunk = 4096;
+		const char *src = (const char*)positions;
+		workerPool().parallelFor(int((vertexCount + chunk - 1) / chunk), [&](int job) {
+			size_t end = std::min(vertexCount, size_t(job + 1) * chunk);
+			for (size_t i = size_t(job) * chunk; i < end; i++) {
+				const float *p = (const float*)(src + i * stride);
+				clipVerts[base + i] = mvp * vec4(p[0], p[1], p[2], 1.0f);
+			}
+		});
+
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+			indices.push_back(base + triangleIndices[i]);
+			indices.push_back(base + triangleIndices[i + 1]);
+			indices.push_back(base + triangleIndices[i + 2]);
+		}
+	}
+
+	void rasterize()
+	{
+		ThreadPool &pool = workerPool();
+
+		// triangle setup: clip against the near plane and go to pixel space
+		int triCount = int(indices.size() / 3);
+		const int chunk = 1024;
+		int setupJobs = (triCount + chunk - 1) / chunk;
+		binned.resize(setupJobs);
+		pool.parallelFor(setupJobs, [&](int job) {
+			vector<ScreenTri> &out = binned[job];
+			out.clear();
+			int end = std::min(triCount, (job + 1) * chunk);
+			for (int t = job * chunk; t < end; t++)
+				setupTriangle(clipVerts[indices[3 * t]], clipVerts[indices[3 * t + 1]], clipVerts[indices[3 * t + 2]], out);
+		});
+
+		// each job owns a band of rows, so no two threads touch the same pixel
+		depth[0].assign(WIDTH * HEIGHT, 1.0f);
+		pool.parallelFor(HEIGHT / BAND, [&](int band) {
+			int y0 = band * BAND, y1 = y0 + BAND;
+			for (int j = 0; j < setupJobs; j++) {
+				for (unsigned int t = 0; t < binned[j].size(); t++)
+					rasterizeTriangle(binned[j][t], y0, y1);
+			}
+		});
+
+		buildHierarchy();
+	}
+
+	// true unless the box is certainly hidden behind the rasterized occluders
+	bool visible(const AABB &box) const
+	{
+		if (!box.valid())
+			return false;
+
+		float xmin = FLT_MAX, ymin = FLT_MAX, xmax = -FLT_MAX, ymax = -FLT_MAX, zmin = FLT_MAX;
+		for (int i = 0; i < 8; i++) {
+			vec3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+			vec4 clip = viewProjection * vec4(corner, 1.0f);
+			// crossing the near plane: no reliable screen rectangle
+			if (clip.w <= NEAR_W)
+				return true;
+			float x = (clip.x / clip.w * 0.5f + 0.5f) * WIDTH;
+			float y = (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT;
+			float z = clip.z / clip.w * 0.5f + 0.5f;
+			xmin = std::min(xmin, x); xmax = std::max(xmax, x);
+			ymin = std::min(ymin, y); ymax = std::max(ymax, y);
+			zmin = std::min(zmin, z);
+		}
+		if (xmax < 0 || ymax < 0 || xmin > WIDTH || ymin > HEIGHT)
+			return true;	// outside the view, left to the frustum test
+
+		int x0 = std::max(0, int(xmin)), x1 = std::min(WIDTH - 1, int(xmax));
+		int y0 = std::max(0, int(ymin)), y1 = std::min(HEIGHT - 1, int(ymax));
+
+		// the level at which the rectangle spans at most 4x4 texels
+		int level = 0;
+		while (level + 1 < LEVELS && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3))
+			level++;
+
+		int w = WIDTH >> level;
+		const vector<float> &mip = depth[level];
+		for (int y = y0 >> level; y <= (y1 >> level); y++) {
+			for (int x = x0 >> level; x <= (x1 >> level); x++) {
+				if (zmin <= mip[y * w + x] + DEPTH_BIAS)
+					return true;
+			}
+		}
+		return false;
+	}
+
+	// full resolution depth, row 0 at the bottom of the screen
+	const vector<float> &depthBuffer() const { return depth[0]; }
+
+private:
+	static const int LEVELS = 6;
+	static constexpr float NEAR_W = 1e-5f;
+	static constexpr float DEPTH_BIAS = 1e-4f;
+
+	struct ScreenTri {
+		float x[3], y[3], z[3];
+	};
+
+	mat4 viewProjection;
+	vector<vec4> clipVerts;
+	vector<unsigned int> indices;
+	vector<vector<ScreenTri>> binned;
+	vector<float> depth[LEVELS];
+
+	void setupTriangle(const vec4 &a, const vec4 &b, const vec4 &c, vector<ScreenTri> &out) const
+	{
+		// trivially outside one of the side planes or the far plane
+		if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+			(a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+			(a.z > a.w && b.z > b.w && c.z > c.w))
+			return;
+
+		// Sutherland-Hodgman against the near plane z = -w
+		vec4 in[3] = { a, b, c };
+		vec4 poly[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++) {
+			const vec4 &p = in[i], &q = in[(i + 1) % 3];
+			float dp = p.z + p.w, dq = q.z + q.w;
+			if (dp >= 0)
+				poly[count++] = p;
+			if ((dp >= 0) != (dq >= 0))
+				poly[count++] = p + (q - p) * (dp / (dp - dq));
+		}
+		if (count < 3)
+			return;
+
+		float sx[4], sy[4], sz[4];
+		for (int i = 0; i < count; i++) {
+			float w = std::max(poly[i].w, NEAR_W);
+			sx[i] = (poly[i].x / w * 0.5f + 0.5f) * WIDTH;
+			sy[i] = (poly[i].y / w * 0.5f + 0.5f) * HEIGHT;
+			sz[i] = std::max(0.0f, poly[i].z / w * 0.5f + 0.5f);
+		}
+		for (int i = 1; i + 1 < count; i++) {
+			ScreenTri tri;
+			int id[3] = { 0, i, i + 1 };
+			// both windings are rasterized; make the signed area positive
+			float area = (sx[id[1]] - sx[id[0]]) * (sy[id[2]] - sy[id[0]]) - (sy[id[1]] - sy[id[0]]) * (sx[id[2]] - sx[id[0]]);
+			if (area == 0)
+				continue;
+			if (area < 0)
+				std::swap(id[1], id[2]);
+			for (int k = 0; k < 3; k++) {
+				tri.x[k] = sx[id[k]];
+				tri.y[k] = sy[id[k]];
+				tri.z[k] = sz[id[k]];
+			}
+			out.push_back(tri);
+		}
+	}
+
+	void rasterizeTriangle(const ScreenTri &tri, int bandY0, int bandY1)
+	{
+		float fxmin = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+		float fxmax = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+		float fymin = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+		float fymax = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+		int xmin = std::max(0, int(fxmin)) & ~3;
+		int xmax = std::min(WIDTH - 1, int(fxmax));
+		int ymin = std::max(bandY0, int(fymin));
+		int ymax = std::min(bandY1 - 1, int(fymax));
+		if (xmin > xmax || ymin > ymax)
+			return;
+
+		// edge functions e_i(x, y) = A_i x + B_i y + C_i, positive inside
+		float A[3], B[3], C[3];
+		for (int i = 0; i < 3; i++) {
+			int j = (i + 1) % 3;
+			A[i] = tri.y[i] - tri.y[j];
+			B[i] = tri.x[j] - tri.x[i];
+			C[i] = tri.x[i] * tri.y[j] - tri.x[j] * tri.y[i];
+		}
+		float area = C[0] + C[1] + C[2];
+		// depth as a plane over the barycentrics: e1 weights vertex 0, e2 vertex 1, e0 vertex 2
+		float invArea = 1.0f / area;
+		float za = (tri.z[0] * A[1] + tri.z[1] * A[2] + tri.z[2] * A[0]) * invArea;
+		float zb = (tri.z[0] * B[1] + tri.z[1] * B[2] + tri.z[2] * B[0]) * invArea;
+		float zc = (tri.z[0] * C[1] + tri.z[1] * C[2] + tri.z[2] * C[0]) * invArea;
+
+		float *buffer = &depth[0][0];
+#ifdef OCCLUSION_SSE
+		const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		const __m128 zero = _mm_setzero_ps();
+		__m128 a0 = _mm_set1_ps(A[0]), a1 = _mm_set1_ps(A[1]), a2 = _mm_set1_ps(A[2]), az = _mm_set1_ps(za);
+		for (int y = ymin; y <= ymax; y++) {
+			float py = y + 0.5f;
+			__m128 r0 = _mm_set1_ps(B[0] * py + C[0]);
+			__m128 r1 = _mm_set1_ps(B[1] * py + C[1]);
+			__m128 r2 = _mm_set1_ps(B[2] * py + C[2]);
+			__m128 rz = _mm_set1_ps(zb * py + zc);
+			float *row = buffer + y * WIDTH;
+			for (int x = xmin; x <= xmax; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+				__m128 z = _mm_add_ps(_mm_mul_ps(az, px), rz);
+				__m128 old = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+			}
+		}
+#else
+		for (int y = ymin; y <= ymax; y++) {
+			float py = y + 0.5f;
+			float *row = buffer + y * WIDTH;
+			for (int x = xmin; x <= xmax; x++) {
+				float px = x + 0.5f;
+				if (A[0] * px + B[0] * py + C[0] < 0 || A[1] * px + B[1] * py + C[1] < 0 || A[2] * px + B[2] * py + C[2] < 0)
+					continue;
+				row[x] = std::min(row[x], za * px + zb * py + zc);
+			}
+		}
+#endif
+	}
+
+	// every texel of level k holds the farthest depth of its 2x2 children in level k - 1
+	void buildHierarchy()
+	{
+		for (int level = 1; level < LEVELS; level++) {
+			int w = WIDTH >> level, h = HEIGHT >> level, pw = WIDTH >> (level - 1);
+			const vector<float> &src = depth[level - 1];
+			vector<float> &dst = depth[level];
+			dst.resize(w * h);
+			for (int y = 0; y < h; y++) {
+				for (int x = 0; x < w; x++) {
+					const float *p = &src[(2 * y) * pw + 2 * x];
+					dst[y * w + x] = std::max(std::max(p[0], p[1]), std::max(p[pw], p[pw + 1]));
+				}
+			}
+		}
+	}
+};
+
+#endif
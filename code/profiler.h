@@ -0,0 +1,293 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include "trace.h"
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+
+/*
+	Per pass CPU and GPU timing, built with -DPROFILER only; without it the
+	PROFILE_* macros below expand to nothing and none of this is compiled in.
+	A section is a name (a string literal, looked up by pointer first) timed
+	by every PROFILE_SCOPE that uses it. The CPU time is taken with the high
+	resolution clock; the GPU time from a pair of GL_TIMESTAMP queries, which
+	unlike GL_TIME_ELAPSED nest (eye > pass) and do not collide with the
+	frame timer of the dynamic resolution. The queries of a frame go into one
+	of FRAMES slots and are only read when the GPU has passed the last of
+	them, so timing never stalls; a frame that finds every slot pending is
+	not timed on the GPU. The times of a section are summed per frame (both
+	eyes) and the last HISTORY frames give min / avg / p99. The GPU time of a
+	section is from its first command to its last, bubbles included.
+	Main thread only, GL sections need the current context.
+*/
+#ifdef PROFILER
+
+class Profiler {
+public:
+	static const int FRAMES = 4;		// frames of queries in flight
+	static const int HISTORY = 128;		// frames in the statistics
+
+	struct Stats {
+		double minMs, avgMs, p99Ms;
+		int samples;
+	};
+
+	int frames;			// ended so far
+	int gpuSkipped;		// frames not timed on the GPU because every slot was pending
+
+	Profiler() : frames(0), gpuSkipped(0), slot(0), timing(false) {}
+
+	// index of a section, registered on first use
+	int section(const char *name)
+	{
+		for (unsigned int i = 0; i < sections.size(); i++)
+			if (sections[i].name == name)
+				return i;
+		for (unsigned int i = 0; i < sections.size(); i++) {
+			if (sections[i].label == name) {
+				sections[i].name = name;
+				return i;
+			}
+		}
+		Section created;
+		created.name = name;
+		created.label = name;
+		created.frameCpu = 0.0;
+		created.entered = false;
+		sections.push_back(created);
+		return (int)sections.size() - 1;
+	}
+
+	void addCpu(int id, double ms)
+	{
+		sections[id].frameCpu += ms;
+		sections[id].entered = true;
+	}
+
+	// a GL_TIMESTAMP query before (begin) or after (end) the commands of a section
+	void timestamp(int id, bool begin)
+	{
+		if (!timing)
+			return;
+		Slot &current = slots[slot];
+		if (current.used == current.queries.size()) {
+			current.queries.push_back(0);
+			glGenQueries(1, &current.queries.back());
+		}
+		glQueryCounter(current.queries[current.used], GL_TIMESTAMP);
+		Stamp stamp = { id, current.used++, begin };
+		current.stamps.push_back(stamp);
+	}
+
+	// before the first section of a frame
+	void beginFrame()
+	{
+		collect();
+		Slot &current = slots[slot];
+		timing = !current.pending;
+		if (!timing) {
+			// its queries are still in flight, collect() reads them later
+			gpuSkipped++;
+			return;
+		}
+		current.used = 0;
+		current.stamps.clear();
+	}
+
+	// after the last section of a frame: the CPU sums go into the history, the slot is sent off
+	void endFrame()
+	{
+		for (unsigned int i = 0; i < sections.size(); i++) {
+			if (sections[i].entered)
+				push(sections[i].cpu, sections[i].frameCpu);
+			sections[i].frameCpu = 0.0;
+			sections[i].entered = false;
+		}
+		if (timing) {
+			slots[slot].pending = !slots[slot].stamps.empty();
+			slot = (slot + 1) % FRAMES;
+		}
+		timing = false;
+		frames++;
+	}
+
+	Stats cpuStats(int id) const { return stats(sections[id].cpu); }
+	Stats gpuStats(int id) const { return stats(sections[id].gpu); }
+
+	void report(ostream &out) const
+	{
+		out << "* profile of the last " << std::min(frames, HISTORY) << " frames, ms per frame (min / avg / p99)" << endl;
+		out << fixed << setprecision(3);
+		for (unsigned int i = 0; i < sections.size(); i++) {
+			Stats cpu = cpuStats(i), gpu = gpuStats(i);
+			out << "  " << left << setw(18) << sections[i].label << right
+				<< " cpu " << setw(8) << cpu.minMs << " " << setw(8) << cpu.avgMs << " " << setw(8) << cpu.p99Ms;
+			if (gpu.samples > 0)
+				out << "   gpu " << setw(8) << gpu.minMs << " " << setw(8) << gpu.avgMs << " " << setw(8) << gpu.p99Ms;
+			out << endl;
+		}
+		if (gpuSkipped)
+			out << "  " << gpuSkipped << " frames not timed on the GPU" << endl;
+		out.unsetf(ios::floatfield);
+		out << setprecision(6);
+	}
+
+private:
+	// rolling window of per frame times
+	struct History {
+		vector<float> ms;
+		int next;
+		History() : next(0) {}
+	};
+
+	struct Section {
+		const char *name;		// the literal last used, compared first
+		string label;
+		History cpu, gpu;
+		double frameCpu;
+		bool entered;
+	};
+
+	struct Stamp {
+		int section;
+		unsigned int query;
+		bool begin;
+	};
+
+	struct Slot {
+		vector<unsigned int> queries;
+		unsigned int used;
+		vector<Stamp> stamps;
+		bool pending;
+		Slot() : used(0), pending(false) {}
+	};
+
+	vector<Section> sections;
+	Slot slots[FRAMES];
+	int slot;			// of the frame being recorded
+	bool timing;		// the frame being recorded has a slot
+	vector<GLuint64> times, open;
+	vector<double> frameGpu;
+
+	static void push(History &history, double ms)
+	{
+		if ((int)history.ms.size() < HISTORY)
+			history.ms.push_back((float)ms);
+		else
+			history.ms[history.next] = (float)ms;
+		history.next = (history.next + 1) % HISTORY;
+	}
+
+	static Stats stats(const History &history)
+	{
+		Stats result = { 0.0, 0.0, 0.0, (int)history.ms.size() };
+		if (history.ms.empty())
+			return result;
+		vector<float> sorted(history.ms);
+		sort(sorted.begin(), sorted.end());
+		double sum = 0.0;
+		for (unsigned int i = 0; i < sorted.size(); i++)
+			sum += sorted[i];
+		result.minMs = sorted.front();
+		result.avgMs = sum / sorted.size();
+		result.p99Ms = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+		return result;
+	}
+
+	// reads the finished slots, oldest first; the queries complete in order so the last one tells
+	void collect()
+	{
+		for (int age = 0; age < FRAMES; age++) {
+			Slot &pending = slots[(slot + age) % FRAMES];
+			if (!pending.pending)
+				continue;
+			GLint available = 0;
+			glGetQueryObjectiv(pending.queries[pending.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				break;
+			times.resize(pending.used);
+			for (unsigned int i = 0; i < pending.used; i++)
+				glGetQueryObjectui64v(pending.queries[i], GL_QUERY_RESULT, &times[i]);
+
+			// a section does not nest in itself, its begin is kept until the next end
+			frameGpu.assign(sections.size(), -1.0);
+			open.assign(sections.size(), 0);
+			for (unsigned int i = 0; i < pending.stamps.size(); i++) {
+				const Stamp &stamp = pending.stamps[i];
+				if (stamp.begin) {
+					open[stamp.section] = times[stamp.query];
+					continue;
+				}
+				double ms = (times[stamp.query] - open[stamp.section]) / 1e6;
+				frameGpu[stamp.section] = std::max(frameGpu[stamp.section], 0.0) + ms;
+			}
+			for (unsigned int i = 0; i < sections.size(); i++)
+				if (frameGpu[i] >= 0.0)
+					push(sections[i].gpu, frameGpu[i]);
+			pending.pending = false;
+		}
+	}
+};
+
+inline Profiler &profiler()
+{
+	static Profiler instance;
+	return instance;
+}
+
+// times the rest of the enclosing block on the CPU and, with gpu, on the GPU
+class ProfileScope {
+public:
+	ProfileScope(const char *name, bool gpu) : id(profiler().section(name)), gpu(gpu),
+		start(chrono::high_resolution_clock::now())
+	{
+		if (gpu)
+			profiler().timestamp(id, true);
+	}
+
+	~ProfileScope()
+	{
+		if (gpu)
+			profiler().timestamp(id, false);
+		profiler().addCpu(id, chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count());
+	}
+
+	ProfileScope(const ProfileScope &) = delete;
+	ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+	int id;
+	bool gpu;
+	chrono::high_resolution_clock::time_point start;
+};
+
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_TIMER(name, gpu) ProfileScope PROFILE_JOIN(profileScope, __LINE__)(name, gpu);
+#define PROFILE_BEGIN_FRAME() profiler().beginFrame()
+#define PROFILE_END_FRAME() profiler().endFrame()
+#define PROFILE_REPORT(out) profiler().report(out)
+#else
+#define PROFILE_TIMER(name, gpu)
+#define PROFILE_BEGIN_FRAME()
+#define PROFILE_END_FRAME()
+#define PROFILE_REPORT(out)
+#endif
+
+// the sections are also events of the trace when it is built in (trace.h)
+// CPU and GPU time of the rest of the block, the GL context must be current
+#define PROFILE_SCOPE(name) PROFILE_TIMER(name, true) TRACE_SCOPE(name)
+// CPU time only, for code that issues no GL commands
+#define PROFILE_CPU_SCOPE(name) PROFILE_TIMER(name, false) TRACE_SCOPE(name)
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef RAYTRACE_H
+#define RAYTRACE_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "model.h"
+#include "bvh.h"
+#include "softraster.h"
+#include "threadpool.h"
+
+#include <vector>
+#include <chrono>
+#include <cfloat>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Offline ray tracer for reference images of the scenes, on the CPU only.
+	draw() and drawUnlit() take the same meshes, matrices and lamp settings as
+	SoftwareRasterizer. build() takes every triangle to world space and builds
+	one SAH BVH over the lit meshes and one over the unlit ones (the lamp).
+	render() traces samples x samples stratified rays per pixel from the near
+	plane through the inverse view projection, so the image lines up with the
+	GL frame, and sends a shadow ray to the lamp from every lit hit. Unlit
+	meshes are seen but cast no shadow, or the lamp model would hide its own
+	light.
+*/
+class RayTracer {
+public:
+	static const int TILE = 16;		// pixels per side of a render job
+
+	bool shadows;
+
+	// statistics of the last build() and render()
+	double buildMs, renderMs;
+	size_t primaryRays, shadowRays;
+
+	RayTracer(ThreadPool &pool = workerPool())
+		: shadows(true), buildMs(0), renderMs(0), primaryRays(0), shadowRays(0), pool(pool) {}
+
+	RayTracer(const RayTracer &) = delete;
+	RayTracer &operator=(const RayTracer &) = delete;
+
+	void clear()
+	{
+		draws.clear();
+		lit.clear();
+		unlit.clear();
+	}
+
+	// a lit mesh, normalMatrix is the inverse transpose of model
+	void draw(const Mesh &mesh, const mat4 &model, const mat4 &normalMatrix, const SoftLight &light)
+	{
+		DrawCall call;
+		call.mesh = &mesh;
+		call.model = model;
+		call.normal = mat3(normalMatrix);
+		call.light = light;
+		call.lit = true;
+		call.colour = vec3(1.0f);
+		materialMaps(mesh, call.diffuseMap, call.specularMap);
+		draws.push_back(call);
+	}
+
+	// a mesh in one flat colour, for the lamp
+	void drawUnlit(const Mesh &mesh, const mat4 &model, const vec3 &colour)
+	{
+		DrawCall call;
+		call.mesh = &mesh;
+		call.model = model;
+		call.normal = mat3(1.0f);
+		call.lit = false;
+		call.colour = colour;
+		call.diffuseMap = call.specularMap = NULL;
+		draws.push_back(call);
+	}
+
+	// world space triangles and their hierarchies, after the last draw
+	void build()
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		lit.clear();
+		unlit.clear();
+		for (unsigned int d = 0; d < draws.size(); d++)
+			(draws[d].lit ? lit : unlit).append(draws[d], d);
+		lit.bvh.build(lit.positions, lit.indices);
+		unlit.bvh.build(unlit.positions, unlit.indices);
+		buildMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	size_t triangleCount() const { return lit.bvh.triangleCount() + unlit.bvh.triangleCount(); }
+	size_t nodeCount() const { return lit.bvh.nodeCount() + unlit.bvh.nodeCount(); }
+
+	double raysPerSecond() const
+	{
+		return renderMs > 0 ? (primaryRays + shadowRays) / renderMs * 1000.0 : 0.0;
+	}
+
+	// renders one view into rgba (width x height, rows bottom-up like glReadPixels)
+	void render(int width, int height, const mat4 &view, const mat4 &projection, const vec3 &eye, int samples,
+		vector<unsigned char> &rgba)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+		samples = std::max(samples, 1);
+		rgba.resize((size_t)width * height * 4);
+		mat4 inverseViewProjection = inverse(projection * view);
+
+		int tilesX = (width + TILE - 1) / TILE, tilesY = (height + TILE - 1) / TILE;
+		vector<size_t> primary(tilesX * tilesY), shadow(tilesX * tilesY);
+		pool.parallelFor(tilesX * tilesY, [&](int tile) {
+			int x0 = (tile % tilesX) * TILE, y0 = (tile / tilesX) * TILE;
+			int x1 = std::min(x0 + TILE, width), y1 = std::min(y0 + TILE, height);
+			size_t shadowCount = 0;
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					vec3 sum(0.0f);
+					for (int sy = 0; sy < samples; sy++) {
+						for (int sx = 0; sx < samples; sx++) {
+							vec2 ndc((x + (sx + 0.5f) / samples) / width * 2.0f - 1.0f,
+								(y + (sy + 0.5f) / samples) / height * 2.0f - 1.0f);
+							sum += trace(viewRay(inverseViewProjection, ndc), eye, shadowCount);
+						}
+					}
+					storeColour(&rgba[((size_t)y * width + x) * 4], sum / float(samples * samples));
+				}
+			}
+			primary[tile] = size_t(x1 - x0) * (y1 - y0) * samples * samples;
+			shadow[tile] = shadowCount;
+		});
+
+		primaryRays = shadowRays = 0;
+		for (unsigned int i = 0; i < primary.size(); i++) {
+			primaryRays += primary[i];
+			shadowRays += shadow[i];
+		}
+		renderMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+private:
+	struct DrawCall {
+		const Mesh *mesh;
+		mat4 model;
+		mat3 normal;
+		SoftLight light;
+		bool lit;
+		vec3 colour;
+		const TextureImage *diffuseMap, *specularMap;
+	};
+
+	// world space triangles of some draws
+	struct Geometry {
+		vector<vec3> positions;
+		vector<vec3> normals;
+		vector<vec2> uvs;
+		vector<unsigned int> indices;
+		vector<unsigned int> draw;		// per triangle
+		TriangleBVH bvh;
+
+		void clear()
+		{
+			positions.clear();
+			normals.clear();
+			uvs.clear();
+			indices.clear();
+			draw.clear();
+		}
+
+		void append(const DrawCall &call, unsigned int index)
+		{
+			const vector<Vertex> &vertices = call.mesh->vertices;
+			const vector<unsigned int> &meshIndices = call.mesh->indices;
+			unsigned int base = (unsigned int)positions.size();
+			for (unsigned int i = 0; i < vertices.size(); i++) {
+				positions.push_back(vec3(call.model * vec4(vertices[i].Position, 1.0f)));
+				normals.push_back(call.normal * vertices[i].Normal);
+				uvs.push_back(vertices[i].TexCoords);
+			}
+			for (unsigned int i = 0; i + 2 < meshIndices.size(); i += 3) {
+				for (int k = 0; k < 3; k++)
+					indices.push_back(base + meshIndices[i + k]);
+				draw.push_back(index);
+			}
+		}
+	};
+
+	ThreadPool &pool;
+	vector<DrawCall> draws;
+	Geometry lit, unlit;
+
+	vec3 trace(const Ray &ray, const vec3 &eye, size_t &shadowCount) const
+	{
+		RayHit hit;
+		hit.t = FLT_MAX;
+		bool hitLit = lit.bvh.intersect(ray, hit);
+		// the lamp only counts in front of the nearest lit surface
+		RayHit lampHit = hit;
+		if (unlit.bvh.intersect(ray, lampHit))
+			return draws[unlit.draw[lampHit.triangle]].colour;
+		if (!hitLit)
+			return skyColour(ray.direction);
+
+		const DrawCall &call = draws[lit.draw[hit.triangle]];
+		const unsigned int *t = &lit.indices[3 * hit.triangle];
+		float w = 1.0f - hit.u - hit.v;
+		vec3 point = ray.origin + ray.direction * hit.t;
+		vec3 normal = lit.normals[t[0]] * w + lit.normals[t[1]] * hit.u + lit.normals[t[2]] * hit.v;
+		vec2 uv = lit.uvs[t[0]] * w + lit.uvs[t[1]] * hit.u + lit.uvs[t[2]] * hit.v;
+
+		// missing maps: white albedo, no specular, as in the rasterizer
+		vec3 albedo = call.diffuseMap ? sampleTexture(*call.diffuseMap, uv) : vec3(1.0f);
+		vec3 specularMap = call.specularMap ? sampleTexture(*call.specularMap, uv) : vec3(0.0f);
+
+		float visibility = 1.0f;
+		if (shadows) {
+			// start just off the surface, on the side facing the lamp
+			vec3 toLight = call.light.position - point;
+			vec3 face = cross(lit.positions[t[1]] - lit.positions[t[0]], lit.positions[t[2]] - lit.positions[t[0]]);
+			float faceLength = length(face);
+			if (faceLength > 0)
+				face /= faceLength;
+			if (dot(face, toLight) < 0)
+				face = -face;
+			Ray shadow;
+			shadow.origin = point + face * 1e-4f;
+			shadow.direction = call.light.position - shadow.origin;
+			shadow.tMax = 1.0f;
+			shadowCount++;
+			if (lit.bvh.occluded(shadow))
+				visibility = 0.0f;
+		}
+		return call.light.shade(point, normal, eye, albedo, specularMap, visibility);
+	}
+};
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <glad/glad.h>
+
+#include "memtrack.h"
+
+#include <vector>
+#include <cstring>
+
+using namespace std;
+
+/*
+	Asynchronous frame readback through a ring of pixel buffer objects.
+	queue() starts glReadPixels into the next PBO, which returns at once
+	because the copy happens on the GPU; a fence marks when it is done.
+	pop() hands back the oldest frame, normally long finished by then, so
+	rendering of the following frames overlaps with the transfers.
+*/
+class ReadbackRing {
+public:
+	static const int SLOTS = 3;
+
+	int width, height;
+	int stalls;		// pops that had to wait for the GPU
+
+	ReadbackRing(int width, int height) : width(width), height(height), stalls(0), head(0), count(0), memory("readback")
+	{
+		glGenBuffers(SLOTS, pbos);
+		for (int i = 0; i < SLOTS; i++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, bytes(), NULL, GL_STREAM_READ);
+			fences[i] = 0;
+			frames[i] = -1;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		memory.set(MEM_GPU_STREAM, SLOTS * bytes());
+	}
+
+	ReadbackRing(const ReadbackRing &) = delete;
+	ReadbackRing &operator=(const ReadbackRing &) = delete;
+
+	~ReadbackRing()
+	{
+		for (int i = 0; i < SLOTS; i++) {
+			if (fences[i])
+				glDeleteSync(fences[i]);
+		}
+		glDeleteBuffers(SLOTS, pbos);
+	}
+
+	size_t bytes() const { return (size_t)width * height * 4; }
+	bool full() const { return count == SLOTS; }
+	bool empty() const { return count == 0; }
+
+	// reads the bound read framebuffer into the next free slot; the ring must not be full
+	void queue(int frame)
+	{
+		int slot = (head + count) % SLOTS;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		frames[slot] = frame;
+		count++;
+	}
+
+	// copies out the oldest queued frame (RGBA, rows bottom-up), returns its number
+	int pop(vector<unsigned char> &pixels)
+	{
+		int slot = head;
+		if (glClientWaitSync(fences[slot], 0, 0) == GL_TIMEOUT_EXPIRED) {
+			stalls++;
+			while (glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+				;
+		}
+		glDeleteSync(fences[slot]);
+		fences[slot] = 0;
+
+		pixels.resize(bytes());
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[slot]);
+		void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes(), GL_MAP_READ_BIT);
+		if (data) {
+			memcpy(&pixels[0], data, bytes());
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		int frame = frames[slot];
+		head = (head + 1) % SLOTS;
+		count--;
+		return frame;
+	}
+
+private:
+	unsigned int pbos[SLOTS];
+	GLsync fences[SLOTS];
+	int frames[SLOTS];
+	int head, count;
+	MemoryAccount memory;
+};
+
+#endif
@@ -0,0 +1,121 @@
+#ifndef RENDERTARGET_H
+#define RENDERTARGET_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "memtrack.h"
+
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Colour and depth-stencil textures of one eye, for the passes that read back
+	what an eye rendered (reprojection) or render it smaller than its viewport
+	(dynamic resolution, foveation). The textures are allocated at a capacity
+	and an eye may use any part of them from the origin up, so changing the
+	render size every frame never reallocates anything.
+*/
+class TextureTarget {
+public:
+	int width, height;		// capacity
+	unsigned int fbo, color, depth;
+
+	TextureTarget() : width(0), height(0), fbo(0), color(0), depth(0), memory("render target") {}
+
+	TextureTarget(const TextureTarget &) = delete;
+	TextureTarget &operator=(const TextureTarget &) = delete;
+
+	~TextureTarget()
+	{
+		release();
+	}
+
+	// (re)allocates when the capacity changed
+	void resize(int newWidth, int newHeight)
+	{
+		if (newWidth == width && newHeight == height)
+			return;
+		release();
+		width = newWidth;
+		height = newHeight;
+		if (width <= 0 || height <= 0)
+			return;
+
+		glGenTextures(1, &color);
+		glBindTexture(GL_TEXTURE_2D, color);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		parameters();
+		glGenTextures(1, &depth);
+		glBindTexture(GL_TEXTURE_2D, depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		parameters();
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "ERROR::RENDERTARGET:: framebuffer is not complete" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		memory.set(MEM_GPU_TARGET, textureBytes(width, height, 4 + 4, false));
+	}
+
+	void bind() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	}
+
+	// copies the used part (0, 0, usedWidth, usedHeight) into viewport of framebuffer, stretched when the sizes differ
+	void blit(int usedWidth, int usedHeight, unsigned int framebuffer, const vec4 &viewport) const
+	{
+		int x = (int)viewport.x, y = (int)viewport.y, w = (int)viewport.z, h = (int)viewport.w;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+		// the blit is scissored like any draw
+		glScissor(x, y, w, h);
+		glBlitFramebuffer(0, 0, usedWidth, usedHeight, x, y, x + w, y + h, GL_COLOR_BUFFER_BIT,
+			usedWidth == w && usedHeight == h ? GL_NEAREST : GL_LINEAR);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	}
+
+	// RGBA rows bottom-up of the used part, blocks until it is rendered
+	void read(int usedWidth, int usedHeight, vector<unsigned char> &pixels) const
+	{
+		pixels.resize((size_t)usedWidth * usedHeight * 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, usedWidth, usedHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	}
+
+private:
+	MemoryAccount memory;
+
+	void release()
+	{
+		if (fbo)
+			glDeleteFramebuffers(1, &fbo);
+		if (color)
+			glDeleteTextures(1, &color);
+		if (depth)
+			glDeleteTextures(1, &depth);
+		fbo = color = depth = 0;
+		width = height = 0;
+		memory.set(MEM_GPU_TARGET, 0);
+	}
+
+	static void parameters()
+	{
+		// read with texelFetch or blitted, never filtered across mip levels
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+};
+
+#endif
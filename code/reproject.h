@@ -0,0 +1,221 @@
+#ifndef REPROJECT_H
+#define REPROJECT_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "rendertarget.h"
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+enum ReprojectMode {
+	REPROJECT_OFF,			// both eyes fully rendered
+	REPROJECT_RERENDER,		// the holes of the warped eye are rendered again, exact up to shading
+	REPROJECT_FILL			// the holes are filled from the background next to them, no second scene pass
+};
+
+/*
+	Stereo reprojection: the source eye is rendered with its depth into a
+	texture target and warped into the other eye. The eyes are only delta
+	apart, so most of the other eye is the same surfaces slightly shifted.
+	Every source pixel becomes a point that reproject() takes back to world
+	space with the source depth and projects into the target eye; the depth
+	test keeps the nearest, and the stencil marks the pixels that got one.
+	Sky pixels are warped as directions, the way sky.vs draws them.
+	What is left are disocclusions (surfaces the source eye could not see)
+	and cracks where a surface is wider in the target eye. In
+	REPROJECT_RERENDER the caller draws the eye again with the stencil test
+	left on by reproject(), so only those pixels are shaded; REPROJECT_FILL
+	instead copies the farther of the nearest covered pixels on the same row,
+	as a disocclusion always uncovers background.
+*/
+class StereoReprojector {
+public:
+	static const int FILL_RADIUS = 32;		// pixels searched on each side of a hole
+
+	int width, height;		// render size of an eye, at most the capacity given to resize
+
+	StereoReprojector() : width(0), height(0), vao(0) {}
+
+	StereoReprojector(const StereoReprojector &) = delete;
+	StereoReprojector &operator=(const StereoReprojector &) = delete;
+
+	~StereoReprojector()
+	{
+		if (vao)
+			glDeleteVertexArrays(1, &vao);
+	}
+
+	// (re)creates the eye targets when the largest eye size changed
+	void resize(int eyeWidth, int eyeHeight)
+	{
+		source.resize(eyeWidth, eyeHeight);
+		target.resize(eyeWidth, eyeHeight);
+		if (!vao)
+			glGenVertexArrays(1, &vao);
+	}
+
+	// binds the source eye's target for an eye of width x height, rendered at (0, 0, width, height)
+	void bindSource(int eyeWidth, int eyeHeight)
+	{
+		width = std::min(eyeWidth, source.width);
+		height = std::min(eyeHeight, source.height);
+		source.bind();
+	}
+
+	// copies the source eye into its part of framebuffer
+	void presentSource(unsigned int framebuffer, const vec4 &viewport) const
+	{
+		source.blit(width, height, framebuffer, viewport);
+	}
+
+	/*
+		warps the source eye into the target eye's target and leaves it bound with the
+		stencil test passing only in the holes; sourceViewProjection and targetViewProjection
+		are projection * view of the eyes, the sky ones use the view rotation only
+	*/
+	void reproject(Shader &shader, const mat4 &sourceViewProjection, const mat4 &targetViewProjection,
+		const mat4 &sourceSky, const mat4 &targetSky, float pointSize)
+	{
+		target.bind();
+		glViewport(0, 0, width, height);
+		glScissor(0, 0, width, height);
+		glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+		glClearStencil(0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+		glEnable(GL_STENCIL_TEST);
+		glStencilFunc(GL_ALWAYS, 1, 0xFF);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		glStencilMask(0xFF);
+		// the sky lands exactly on the far plane
+		glDepthFunc(GL_LEQUAL);
+		glEnable(GL_PROGRAM_POINT_SIZE);
+
+		shader.use();
+		shader.setMat4("reprojection", targetViewProjection * inverse(sourceViewProjection));
+		shader.setMat4("skyReprojection", targetSky * inverse(sourceSky));
+		shader.setFloat("pointSize", pointSize);
+		shader.setInt("width", width);
+		shader.setInt("height", height);
+		shader.setInt("sourceColor", 0);
+		shader.setInt("sourceDepth", 1);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, source.depth);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, source.color);
+		glBindVertexArray(vao);
+		glDrawArrays(GL_POINTS, 0, width * height);
+		glBindVertexArray(0);
+
+		glDisable(GL_PROGRAM_POINT_SIZE);
+		glDepthFunc(GL_LESS);
+		// from here on only the pixels no point reached pass
+		glStencilFunc(GL_EQUAL, 0, 0xFF);
+		glStencilMask(0x00);
+	}
+
+	// after the holes were drawn: the target eye goes into its part of framebuffer
+	void presentTarget(unsigned int framebuffer, const vec4 &viewport) const
+	{
+		glDisable(GL_STENCIL_TEST);
+		glStencilMask(0xFF);
+		target.blit(width, height, framebuffer, viewport);
+	}
+
+	// instead of drawing the holes: fills them and writes the target eye into its part of framebuffer
+	void fillTarget(Shader &shader, unsigned int framebuffer, const vec4 &viewport) const
+	{
+		glDisable(GL_STENCIL_TEST);
+		glStencilMask(0xFF);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glViewport((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+		glScissor((int)viewport.x, (int)viewport.y, (int)viewport.z, (int)viewport.w);
+		glDisable(GL_DEPTH_TEST);
+
+		shader.use();
+		shader.setVec2("origin", viewport.x, viewport.y);
+		// eye pixels per viewport pixel, below 1 with dynamic resolution
+		shader.setVec2("scale", width / viewport.z, height / viewport.w);
+		shader.setInt("width", width);
+		shader.setInt("radius", FILL_RADIUS);
+		shader.setInt("warped", 0);
+		shader.setInt("warpedDepth", 1);
+		shader.setInt("sourceColor", 2);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, source.color);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, target.depth);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, target.color);
+		glBindVertexArray(vao);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+
+		glEnable(GL_DEPTH_TEST);
+	}
+
+	// share of the target eye no point reached, read back from the stencil (stalls, for measurements)
+	float holeFraction() const
+	{
+		vector<unsigned char> stencil((size_t)width * height);
+		if (stencil.empty())
+			return 0.0f;
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, target.fbo);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &stencil[0]);
+		size_t holes = 0;
+		for (size_t i = 0; i < stencil.size(); i++)
+			holes += stencil[i] == 0;
+		return float(holes) / stencil.size();
+	}
+
+	// RGBA rows bottom-up of the last target eye, for measurements
+	void readTarget(vector<unsigned char> &pixels) const
+	{
+		target.read(width, height, pixels);
+	}
+
+private:
+	TextureTarget source, target;
+	unsigned int vao;		// empty, the shaders make their vertices from gl_VertexID
+};
+
+struct ImageError {
+	double rmse;			// over the RGB channels, in 0..255
+	double psnr;			// dB, infinite for identical images
+	double badPixels;		// share of pixels off by more than 16 in a channel
+};
+
+// difference between an approximated image and the fully rendered one, both RGBA of the same size
+inline ImageError compareImages(const vector<unsigned char> &reference, const vector<unsigned char> &image)
+{
+	ImageError error = { 0.0, INFINITY, 0.0 };
+	size_t pixels = std::min(reference.size(), image.size()) / 4;
+	if (pixels == 0)
+		return error;
+	double sum = 0.0;
+	size_t bad = 0;
+	for (size_t i = 0; i < pixels; i++) {
+		int worst = 0;
+		for (int c = 0; c < 3; c++) {
+			int d = std::abs(int(reference[4 * i + c]) - int(image[4 * i + c]));
+			sum += double(d) * d;
+			worst = std::max(worst, d);
+		}
+		bad += worst > 16;
+	}
+	error.rmse = sqrt(sum / (3.0 * pixels));
+	if (error.rmse > 0)
+		error.psnr = 20.0 * log10(255.0 / error.rmse);
+	error.badPixels = double(bad) / pixels;
+	return error;
+}
+
+#endif
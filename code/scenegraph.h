@@ -0,0 +1,101 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+struct SceneNode {
+	string name;
+	int parent;			// -1 for the root
+	int subtree;		// nodes in the subtree including this one, they follow it directly
+	mat4 local;			// relative to the parent
+	mat4 world;			// cached parent world * local
+	mat4 normal;		// cached inverse transpose of world, for the normals
+	bool dirty;
+};
+
+/*
+	Transform hierarchy of one model.
+	Nodes are stored depth first, so a subtree is a contiguous range and
+	parents always come before their children. Changing a local transform
+	marks only its subtree dirty, and update() recomputes the world matrices
+	of the dirty range and nothing else.
+*/
+class SceneGraph {
+public:
+	vector<SceneNode> nodes;
+	int updates;		// world matrices recomputed so far
+
+	SceneGraph() : updates(0), dirtyBegin(0), dirtyEnd(0) {}
+
+	// nodes must be added depth first, a child right after its parent's earlier children
+	int add(const string &name, const mat4 &local, int parent)
+	{
+		SceneNode node;
+		node.name = name;
+		node.parent = parent;
+		node.subtree = 1;
+		node.local = local;
+		node.world = mat4(1.0f);
+		node.normal = mat4(1.0f);
+		node.dirty = true;
+		int index = (int)nodes.size();
+		nodes.push_back(node);
+		for (int p = parent; p >= 0; p = nodes[p].parent)
+			nodes[p].subtree++;
+		markRange(index, index + 1);
+		return index;
+	}
+
+	void setLocal(int index, const mat4 &local)
+	{
+		nodes[index].local = local;
+		int end = index + nodes[index].subtree;
+		for (int i = index; i < end; i++)
+			nodes[i].dirty = true;
+		markRange(index, end);
+	}
+
+	// recomputes the dirty subtrees, returns whether any matrix changed
+	bool update()
+	{
+		if (dirtyBegin >= dirtyEnd)
+			return false;
+		for (int i = dirtyBegin; i < dirtyEnd; i++) {
+			SceneNode &node = nodes[i];
+			if (!node.dirty)
+				continue;
+			node.world = node.parent < 0 ? node.local : nodes[node.parent].world * node.local;
+			node.normal = mat4(transpose(inverse(mat3(node.world))));
+			node.dirty = false;
+			updates++;
+		}
+		dirtyBegin = dirtyEnd = 0;
+		return true;
+	}
+
+	const mat4 &world(int index) const { return nodes[index].world; }
+
+private:
+	int dirtyBegin, dirtyEnd;		// range holding every dirty node
+
+	void markRange(int begin, int end)
+	{
+		if (dirtyBegin >= dirtyEnd) {
+			dirtyBegin = begin;
+			dirtyEnd = end;
+		}
+		else {
+			dirtyBegin = std::min(dirtyBegin, begin);
+			dirtyEnd = std::max(dirtyEnd, end);
+		}
+	}
+};
+
+#endif
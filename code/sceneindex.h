@@ -0,0 +1,113 @@
+#ifndef SCENEINDEX_H
+#define SCENEINDEX_H
+
+#include <glm/glm.hpp>
+
+#include "model.h"
+#include "bvh.h"
+#include "culling.h"
+
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+using namespace glm;
+
+struct PickHit {
+	int object;				// index in the object list, -1 for none
+	int mesh;
+	unsigned int triangle;	// index within the mesh
+	float t;				// along the pick ray
+	vec3 point;				// world space
+};
+
+/*
+	Spatial index over the objects of the scene, for picking, culling and
+	light range queries. It keeps a DynamicBVH leaf per object: a moved,
+	rotated or scaled object only updates its own leaf, so editing stays
+	O(log n) however many objects there are.
+	Picking goes on to the exact triangles: every Model keeps an object
+	space BVH of its meshes built at load, which a transform change leaves
+	valid, and the ray is tested against those of the objects whose box it
+	enters, nearest first, until no box starts before the nearest hit.
+*/
+class SceneIndex {
+public:
+	DynamicBVH tree;
+
+	SceneIndex() : stale(true) {}
+
+	// objects were added, removed or reordered: the next query inserts all of them again
+	void invalidate() { stale = true; }
+
+	// matches the leaves to the object list after an invalidate
+	void sync(const vector<Model> &objects)
+	{
+		if (!stale)
+			return;
+		tree.clear();
+		leaf.resize(objects.size());
+		for (unsigned int i = 0; i < objects.size(); i++)
+			leaf[i] = tree.insert(objects[i].world_bounds, (int)i);
+		tree.rebuild();
+		stale = false;
+	}
+
+	// call after the object's bounds were updated
+	void objectMoved(const vector<Model> &objects, int object)
+	{
+		if (stale)
+			sync(objects);
+		else
+			tree.update(leaf[object], objects[object].world_bounds);
+	}
+
+	bool pick(const Ray &ray, const vector<Model> &objects, PickHit &hit)
+	{
+		sync(objects);
+		hit.object = -1;
+		hit.t = ray.tMax;
+		float tMax = ray.tMax;
+		tree.intersect(ray, tMax, [&](int object, float &nearest) {
+			RayHit triangle;
+			triangle.t = nearest;
+			int mesh;
+			if (!objects[object].raycast(ray, triangle, mesh))
+				return false;
+			nearest = triangle.t;
+			hit.object = object;
+			hit.mesh = mesh;
+			hit.triangle = triangle.triangle;
+			hit.t = triangle.t;
+			return true;
+		});
+		if (hit.object < 0)
+			return false;
+		hit.point = ray.origin + ray.direction * hit.t;
+		return true;
+	}
+
+	// objects whose box may be inside the frustum, in list order
+	void inFrustum(const vector<Model> &objects, const Frustum &frustum, vector<int> &result)
+	{
+		sync(objects);
+		result.clear();
+		tree.query(frustum, [&](int object) { result.push_back(object); });
+		std::sort(result.begin(), result.end());
+	}
+
+	// objects whose box may be within radius of a point, in list order
+	void inRange(const vector<Model> &objects, const vec3 &center, float radius, vector<int> &result)
+	{
+		sync(objects);
+		result.clear();
+		tree.query(AABB(center - vec3(radius), center + vec3(radius)), [&](int object) { result.push_back(object); });
+		std::sort(result.begin(), result.end());
+	}
+
+private:
+	vector<int> leaf;		// leaf id of every object
+	bool stale;				// leaf no longer matches the object list
+};
+
+#endif
@@ -4,6 +4,9 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "trace.h"
+#include "stats.h"
+
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -16,6 +19,7 @@ public:
 	unsigned int ID;
 	Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
 	{
+		TRACE_SCOPE_DETAIL("Shader", fragmentPath);
 		std::string vertexCode;
 		std::string fragmentCode;
 		std::string geometryCode;
@@ -93,68 +97,105 @@ public:
 		if (geometryPath != nullptr)
 			glDeleteShader(geometry);
 	}
+	// the program is owned by exactly one Shader: it can be moved, not copied, and is deleted with it
+	// ------------------------------------------------------------------------
+	Shader(const Shader &) = delete;
+	Shader &operator=(const Shader &) = delete;
+	Shader(Shader &&other) noexcept : ID(other.ID)
+	{
+		other.ID = 0;
+	}
+	Shader &operator=(Shader &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (ID)
+				glDeleteProgram(ID);
+			ID = other.ID;
+			other.ID = 0;
+		}
+		return *this;
+	}
+	~Shader()
+	{
+		if (ID)
+			glDeleteProgram(ID);
+	}
 	// activate the shader
 	// ------------------------------------------------------------------------
-	void use()
+	void use() const
 	{
+		renderCounters().programBinds++;
 		glUseProgram(ID);
 	}
 	// utility uniform functions
 	// ------------------------------------------------------------------------
 	void setBool(const std::string &name, bool value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
 	}
 	// ------------------------------------------------------------------------
 	void setInt(const std::string &name, int value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
 	void setFloat(const std::string &name, float value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
 	}
 	// ------------------------------------------------------------------------
 	void setVec2(const std::string &name, const glm::vec2 &value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
 	void setVec2(const std::string &name, float x, float y) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y);
 	}
 	// ------------------------------------------------------------------------
 	void setVec3(const std::string &name, const glm::vec3 &value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
 	void setVec3(const std::string &name, float x, float y, float z) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
 	}
 	// ------------------------------------------------------------------------
 	void setVec4(const std::string &name, const glm::vec4 &value) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 	}
-	void setVec4(const std::string &name, float x, float y, float z, float w)
+	void setVec4(const std::string &name, float x, float y, float z, float w) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
 	}
 	// ------------------------------------------------------------------------
 	void setMat2(const std::string &name, const glm::mat2 &mat) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat3(const std::string &name, const glm::mat3 &mat) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 	// ------------------------------------------------------------------------
 	void setMat4(const std::string &name, const glm::mat4 &mat) const
 	{
+		renderCounters().uniformUpdates++;
 		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
 	}
 
@@ -0,0 +1,18 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform Transform {
+    mat4 model;
+    mat4 normalMatrix;
+};
+uniform mat4 view;
+uniform mat4 projection;
+
+// the colour pass compares against this depth with GL_EQUAL, invariant makes
+// model_clustered.vs compute the bit-identical position from the same expression
+invariant gl_Position;
+
+void main()
+{
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,18 @@
+#version 330 core
+// the full resolution inset of a foveated eye over its stretched periphery, faded in at the border
+out vec4 FragColor;
+
+uniform sampler2D inset;
+uniform vec2 origin;		// framebuffer pixel of the inset's lower left corner
+uniform vec2 size;			// of the inset, in pixels
+uniform vec2 lowMargin;		// added to the distance from the left/bottom side, large where it is not faded
+uniform vec2 highMargin;	// the same for the right/top side
+uniform float feather;
+
+void main()
+{
+    vec2 pixel = gl_FragCoord.xy - origin;
+    vec2 edge = min(pixel + lowMargin, size - pixel + highMargin);
+    float alpha = clamp(min(edge.x, edge.y) / feather, 0.0, 1.0);
+    FragColor = vec4(texelFetch(inset, ivec2(pixel), 0).rgb, alpha);
+}
@@ -0,0 +1,42 @@
+#version 330 core
+out vec4 FragColor;
+
+uniform sampler2D warped;		// the reprojected eye, alpha 0 in the holes
+uniform sampler2D warpedDepth;
+uniform sampler2D sourceColor;	// the other eye, when nothing is near
+uniform vec2 origin;			// of the viewport in the framebuffer
+uniform vec2 scale;				// eye pixels per viewport pixel
+uniform int width;				// of the rendered part of the eye
+uniform int radius;
+
+void main()
+{
+    ivec2 pixel = ivec2((gl_FragCoord.xy - origin) * scale);
+    vec4 colour = texelFetch(warped, pixel, 0);
+    if (colour.a > 0.0) {
+        FragColor = colour;
+        return;
+    }
+
+    // the nearest covered pixel on each side of the row
+    ivec2 found[2] = ivec2[2](ivec2(-1), ivec2(-1));
+    for (int side = 0; side < 2; side++) {
+        int step = side == 0 ? -1 : 1;
+        for (int i = 1; i <= radius; i++) {
+            ivec2 p = pixel + ivec2(step * i, 0);
+            if (p.x < 0 || p.x >= width)
+                break;
+            if (texelFetch(warped, p, 0).a > 0.0) {
+                found[side] = p;
+                break;
+            }
+        }
+    }
+
+    // a disocclusion uncovers what is behind, so the farther side wins
+    ivec2 pick = found[0].x >= 0 ? found[0] : found[1];
+    if (found[0].x >= 0 && found[1].x >= 0
+        && texelFetch(warpedDepth, found[1], 0).r > texelFetch(warpedDepth, found[0], 0).r)
+        pick = found[1];
+    FragColor = pick.x >= 0 ? texelFetch(warped, pick, 0) : texelFetch(sourceColor, pixel, 0);
+}
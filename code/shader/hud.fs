@@ -0,0 +1,19 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 texel;
+
+uniform sampler2D font;
+uniform vec2 atlasSize;
+
+void main()
+{
+    if (texel.x < 0.0) {
+        FragColor = vec4(0.0, 0.0, 0.0, 0.6);
+        return;
+    }
+    float ink = texture(font, texel / atlasSize).r;
+    if (ink < 0.5)
+        discard;
+    FragColor = vec4(1.0, 1.0, 0.6, 1.0);
+}
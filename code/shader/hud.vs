@@ -0,0 +1,13 @@
+#version 330 core
+// text overlay: position in viewport pixels, atlas texel in zw (negative for the backdrop)
+layout (location = 0) in vec4 aVertex;
+
+uniform vec2 viewportSize;
+
+out vec2 texel;
+
+void main()
+{
+    texel = aVertex.zw;
+    gl_Position = vec4(aVertex.xy / viewportSize * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,102 @@
+#version 330 core
+out vec4 FragColor;
+
+struct Material {
+    float shininess;
+};
+
+struct Light {
+    vec3 position;
+
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+
+    float constant;
+    float linear;
+    float quadratic;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+in float ViewDepth;
+
+uniform vec3 viewPos;
+uniform Material material;
+uniform Light light;
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_specular1;
+
+// clustered point lights, see lights.h
+uniform samplerBuffer lightData;
+uniform usamplerBuffer clusterData;
+uniform usamplerBuffer lightIndices;
+uniform vec3 clusterGrid;
+uniform vec2 clusterDepth;     // near plane, log(far / near)
+uniform vec4 viewport;         // x, y, width, height of this eye
+
+// cached shadow cube of the lamp, see shadow.h
+uniform samplerCubeShadow shadowMap;
+uniform float shadowFar;
+uniform bool shadowsEnabled;
+
+float lampVisibility()
+{
+    if (!shadowsEnabled)
+        return 1.0;
+    vec3 fromLight = FragPos - light.position;
+    float depth = length(fromLight) / shadowFar;
+    if (depth >= 1.0)
+        return 1.0;
+    // the slope of the surface towards the light needs a larger offset
+    float bias = mix(0.05, 0.01, max(dot(normalize(Normal), normalize(-fromLight)), 0.0)) / shadowFar;
+    return texture(shadowMap, vec4(fromLight, depth - bias));
+}
+
+vec3 shade(vec3 lightDir, vec3 norm, vec3 viewDir, vec3 diffuseColor, vec3 specularColor, vec3 albedo, vec3 specularMap)
+{
+    float diff = max(dot(norm, lightDir), 0.0);
+    vec3 reflectDir = reflect(-lightDir, norm);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
+    return diffuseColor * diff * albedo + specularColor * spec * specularMap;
+}
+
+void main()
+{
+    vec3 albedo = texture(texture_diffuse1, TexCoords).rgb;
+    vec3 specularMap = texture(texture_specular1, TexCoords).rgb;
+    vec3 norm = normalize(Normal);
+    vec3 viewDir = normalize(viewPos - FragPos);
+
+    // the lamp
+    vec3 lightDir = normalize(light.position - FragPos);
+    float distance = length(light.position - FragPos);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));
+    vec3 result = (light.ambient * albedo + lampVisibility() * shade(lightDir, norm, viewDir, light.diffuse, light.specular, albedo, specularMap)) * attenuation;
+
+    // only the point lights binned into this fragment's cluster
+    ivec3 grid = ivec3(clusterGrid);
+    ivec3 cell;
+    cell.xy = ivec2((gl_FragCoord.xy - viewport.xy) / viewport.zw * clusterGrid.xy);
+    cell.z = int(log(max(ViewDepth, clusterDepth.x) / clusterDepth.x) / clusterDepth.y * clusterGrid.z);
+    cell = clamp(cell, ivec3(0), grid - 1);
+    int cluster = (cell.z * grid.y + cell.y) * grid.x + cell.x;
+
+    uvec2 range = texelFetch(clusterData, cluster).xy;
+    for (uint i = 0u; i < range.y; i++) {
+        int index = int(texelFetch(lightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(lightData, 2 * index);
+        vec3 color = texelFetch(lightData, 2 * index + 1).rgb;
+
+        vec3 toLight = positionRadius.xyz - FragPos;
+        float d = length(toLight);
+        // smooth window so the light really ends at its radius
+        float window = clamp(1.0 - pow(d / positionRadius.w, 4.0), 0.0, 1.0);
+        float falloff = window * window / (1.0 + d * d);
+        result += shade(toLight / d, norm, viewDir, color, color, albedo, specularMap) * falloff;
+    }
+
+    FragColor = vec4(result, 1.0);
+}
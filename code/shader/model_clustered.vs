@@ -0,0 +1,30 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec3 FragPos;
+out vec3 Normal;
+out vec2 TexCoords;
+out float ViewDepth;
+
+// this draw's slot of the transform ring, see transforms.h
+layout (std140) uniform Transform {
+    mat4 model;
+    mat4 normalMatrix;
+};
+uniform mat4 view;
+uniform mat4 projection;
+
+// the depth pre-pass of depth.vs relies on it, see there
+invariant gl_Position;
+
+void main()
+{
+    FragPos = vec3(model * vec4(aPos, 1.0));
+    Normal = mat3(normalMatrix) * aNormal;
+    TexCoords = aTexCoords;
+    ViewDepth = -(view * vec4(FragPos, 1.0)).z;
+    // same expression as depth.vs, the depth pre-pass relies on it
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+out vec4 FragColor;
+
+flat in vec4 Color;
+
+void main()
+{
+    // alpha 1 marks the covered pixels for the hole fill
+    FragColor = vec4(Color.rgb, 1.0);
+}
@@ -0,0 +1,30 @@
+#version 330 core
+// one point per source pixel, no vertex buffer
+
+flat out vec4 Color;
+
+uniform sampler2D sourceColor;
+uniform sampler2D sourceDepth;
+uniform mat4 reprojection;		// target projection * view * inverse(source projection * view)
+uniform mat4 skyReprojection;	// the same with the view rotations only
+uniform float pointSize;
+uniform int width;				// of the rendered part of the source eye
+uniform int height;
+
+void main()
+{
+    ivec2 size = ivec2(width, height);
+    ivec2 pixel = ivec2(gl_VertexID % size.x, gl_VertexID / size.x);
+    float depth = texelFetch(sourceDepth, pixel, 0).r;
+    Color = texelFetch(sourceColor, pixel, 0);
+    gl_PointSize = pointSize;
+
+    // window coordinates back to NDC
+    vec3 ndc = vec3((vec2(pixel) + 0.5) / vec2(size), depth) * 2.0 - 1.0;
+    if (depth >= 1.0) {
+        // the sky is at infinity, only the rotation between the eyes moves it; keep it on the far plane
+        gl_Position = (skyReprojection * vec4(ndc.xy, 1.0, 1.0)).xyww;
+        return;
+    }
+    gl_Position = reprojection * vec4(ndc, 1.0);
+}
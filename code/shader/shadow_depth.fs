@@ -0,0 +1,11 @@
+#version 330 core
+in vec4 FragPos;
+
+uniform vec3 lightPos;
+uniform float farPlane;
+
+// linear distance to the light, compared against in model_clustered.fs
+void main()
+{
+    gl_FragDepth = length(FragPos.xyz - lightPos) / farPlane;
+}
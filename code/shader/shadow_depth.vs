@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+layout (std140) uniform Transform {
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+// world space, the geometry shader projects onto the cube faces
+void main()
+{
+    gl_Position = model * vec4(aPos, 1.0);
+}
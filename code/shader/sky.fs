@@ -0,0 +1,23 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec3 Direction;
+
+uniform sampler2D texture_diffuse1;
+uniform bool hasTexture;
+
+void main()
+{
+    if (hasTexture) {
+        FragColor = vec4(texture(texture_diffuse1, TexCoords).rgb, 1.0);
+        return;
+    }
+    // analytic gradient when sky.obj comes without a texture
+    float h = normalize(Direction).y;
+    vec3 zenith = vec3(0.25, 0.45, 0.85);
+    vec3 horizon = vec3(0.75, 0.80, 0.90);
+    vec3 ground = vec3(0.35, 0.33, 0.30);
+    vec3 color = h > 0.0 ? mix(horizon, zenith, pow(h, 0.6)) : mix(horizon, ground, pow(-h, 0.4));
+    FragColor = vec4(color, 1.0);
+}
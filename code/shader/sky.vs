@@ -0,0 +1,22 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+out vec3 Direction;
+
+uniform mat4 projection;
+uniform mat4 view;
+uniform mat4 model;
+
+void main()
+{
+    TexCoords = aTexCoords;
+    // the node transforms of the sky file, see Model::Draw
+    vec3 position = vec3(model * vec4(aPos, 1.0));
+    Direction = position;
+    // rotation only: the sky stays at infinity around the eye
+    vec4 pos = projection * mat4(mat3(view)) * vec4(position, 1.0);
+    // z = w puts every sky fragment on the far plane
+    gl_Position = pos.xyww;
+}
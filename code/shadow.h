@@ -0,0 +1,155 @@
+#ifndef SHADOW_H
+#define SHADOW_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "shader.h"
+#include "model.h"
+#include "culling.h"
+#include "transforms.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Omnidirectional shadow map of the lamp, cached between frames.
+	The depth cubemap (distance to the light / range) is rendered in a single
+	pass through a layered geometry shader, and only again when the light has
+	moved or a caster inside its range was moved; both eyes and every later
+	frame reuse it. The model shader samples it as a samplerCubeShadow.
+*/
+class ShadowCache {
+public:
+	static const int SIZE = 1024;
+	static const int TEXTURE_UNIT = 11;		// after the cluster buffers of lights.h
+
+	float range;		// far plane of the cube faces; nothing beyond casts or receives
+	int renders;		// how often the cube was actually rendered
+
+	ShadowCache() : range(25.0f), renders(0), ready(false), dirty(true), memory("shadow cube") {}
+
+	void invalidate() { dirty = true; }
+
+	// an object moved from one bounding sphere to another
+	void objectMoved(const BoundingSphere &before, const BoundingSphere &after)
+	{
+		if (reaches(before) || reaches(after))
+			dirty = true;
+	}
+
+	// re-renders the cube if it is stale, returns whether it did;
+	// the casters' transforms must already be in the ring
+	bool update(Shader &shadowShader, const vec3 &lightPos, const vector<Model*> &casters, const TransformRing &transforms)
+	{
+		if (!ready)
+			setup();
+		if (lightPos != cachedLightPos)
+			dirty = true;
+		if (!dirty)
+			return false;
+		cachedLightPos = lightPos;
+
+		mat4 projection = perspective(radians(90.0f), 1.0f, 0.05f, range);
+		const vec3 targets[6] = { vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1) };
+		const vec3 ups[6] = { vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0) };
+
+		GLint previous = 0;
+		glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previous);
+		GLboolean scissor = glIsEnabled(GL_SCISSOR_TEST);
+		glDisable(GL_SCISSOR_TEST);
+		glViewport(0, 0, SIZE, SIZE);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glClear(GL_DEPTH_BUFFER_BIT);
+
+		shadowShader.use();
+		for (int i = 0; i < 6; i++)
+			shadowShader.setMat4("shadowMatrices[" + to_string(i) + "]", projection * lookAt(lightPos, lightPos + targets[i], ups[i]));
+		shadowShader.setVec3("lightPos", lightPos);
+		shadowShader.setFloat("farPlane", range);
+
+		for (unsigned int i = 0; i < casters.size(); i++) {
+			if (!reaches(casters[i]->world_sphere))
+				continue;
+			casters[i]->DrawDepth(transforms);
+		}
+
+		glBindFramebuffer(GL_FRAMEBUFFER, previous);
+		if (scissor)
+			glEnable(GL_SCISSOR_TEST);
+
+		dirty = false;
+		renders++;
+		return true;
+	}
+
+	void bind(Shader &shader, bool enabled) const
+	{
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCube);
+		glActiveTexture(GL_TEXTURE0);
+		shader.setInt("shadowMap", TEXTURE_UNIT);
+		shader.setFloat("shadowFar", range);
+		shader.setBool("shadowsEnabled", enabled && ready);
+	}
+
+	// deletes the cube and its framebuffer while the context still exists; a later update builds them again
+	void release()
+	{
+		if (!ready)
+			return;
+		glDeleteFramebuffers(1, &fbo);
+		glDeleteTextures(1, &depthCube);
+		memory.clear();
+		ready = false;
+		dirty = true;
+	}
+
+private:
+	bool ready;
+	bool dirty;
+	vec3 cachedLightPos;
+	unsigned int fbo, depthCube;
+	MemoryAccount memory;
+
+	bool reaches(const BoundingSphere &sphere) const
+	{
+		return length(sphere.center - cachedLightPos) < range + sphere.radius;
+	}
+
+	void setup()
+	{
+		glGenTextures(1, &depthCube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, depthCube);
+		for (int i = 0; i < 6; i++)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24, SIZE, SIZE, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		// hardware depth comparison, linear filtering gives 2x2 PCF for free
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+		glGenFramebuffers(1, &fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthCube, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			cout << "ERROR::SHADOW:: shadow framebuffer is not complete" << endl;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		// DEPTH_COMPONENT24 takes four bytes a texel
+		memory.set(MEM_GPU_TARGET, 6 * textureBytes(SIZE, SIZE, 4, false));
+
+		ready = true;
+	}
+};
+
+#endif
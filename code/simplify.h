@@ -0,0 +1,307 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+using namespace std;
+using namespace glm;
+
+/*
+	Mesh simplification with the quadric error metric (Garland/Heckbert).
+	Edges are collapsed onto one of their existing vertices, so every level is
+	just a new index buffer over the original vertex buffer.
+	Vertices with identical position, normal and uv are merged first. A position
+	shared by several distinct vertices lies on a uv/normal seam; those, and the
+	vertices of open borders, are never moved, which keeps seams and silhouettes.
+	The vertex type only needs Position, Normal and TexCoords members.
+*/
+
+const int LOD_COUNT = 4;			// including the full resolution level
+const size_t LOD_MIN_TRIANGLES = 256;	// smaller meshes are never simplified
+
+namespace simplify_detail {
+
+	// symmetric 4x4 matrix (a2 ab ac ad b2 bc bd c2 cd d2) and the summed plane weight
+	struct Quadric {
+		double q[10];
+		double weight;
+
+		Quadric() { memset(q, 0, sizeof(q)); weight = 0; }
+
+		Quadric(double a, double b, double c, double d, double weight)
+		{
+			q[0] = a * a * weight; q[1] = a * b * weight; q[2] = a * c * weight; q[3] = a * d * weight;
+			q[4] = b * b * weight; q[5] = b * c * weight; q[6] = b * d * weight;
+			q[7] = c * c * weight; q[8] = c * d * weight;
+			q[9] = d * d * weight;
+			this->weight = weight;
+		}
+
+		void add(const Quadric &o)
+		{
+			for (int i = 0; i < 10; i++)
+				q[i] += o.q[i];
+			weight += o.weight;
+		}
+
+		// weighted mean squared distance of p to the planes
+		double error(const vec3 &p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double sum = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+				+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+				+ q[7] * z * z + 2 * q[8] * z
+				+ q[9];
+			return weight > 0 ? fabs(sum) / weight : 0;
+		}
+	};
+
+	struct Collapse {
+		unsigned int from, to;
+		double cost;
+		bool operator<(const Collapse &o) const { return cost < o.cost; }
+	};
+
+	template <typename T>
+	inline size_t hashBytes(const T &value)
+	{
+		// FNV-1a
+		const unsigned char *p = (const unsigned char*)&value;
+		size_t h = 2166136261u;
+		for (size_t i = 0; i < sizeof(T); i++)
+			h = (h ^ p[i]) * 16777619u;
+		return h;
+	}
+
+	struct VertexKey {
+		float data[8];
+		bool operator==(const VertexKey &o) const { return memcmp(data, o.data, sizeof(data)) == 0; }
+	};
+	struct VertexKeyHash {
+		size_t operator()(const VertexKey &k) const { return hashBytes(k); }
+	};
+	struct PositionKey {
+		float data[3];
+		bool operator==(const PositionKey &o) const { return memcmp(data, o.data, sizeof(data)) == 0; }
+	};
+	struct PositionKeyHash {
+		size_t operator()(const PositionKey &k) const { return hashBytes(k); }
+	};
+
+	inline vec3 triangleNormal(const vec3 &a, const vec3 &b, const vec3 &c)
+	{
+		return cross(b - a, c - a);
+	}
+}
+
+// returns an index buffer of at most about targetIndexCount indices, stopping early
+// when the next collapse would move the surface further than targetError (in model units)
+template <typename V>
+vector<unsigned int> simplifyMesh(const vector<V> &vertices, const vector<unsigned int> &indices,
+	size_t targetIndexCount, float targetError)
+{
+	using namespace simplify_detail;
+	size_t vertexCount = vertices.size();
+
+	// merge identical vertices: wedge[i] is the first vertex equal to i
+	vector<unsigned int> wedge(vertexCount);
+	{
+		unordered_map<VertexKey, unsigned int, VertexKeyHash> seen;
+		seen.reserve(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			const V &v = vertices[i];
+			VertexKey key = { { v.Position.x, v.Position.y, v.Position.z, v.Normal.x, v.Normal.y, v.Normal.z, v.TexCoords.x, v.TexCoords.y } };
+			wedge[i] = seen.insert(make_pair(key, (unsigned int)i)).first->second;
+		}
+	}
+
+	// group merged vertices by position, a group with more than one member is a seam
+	vector<unsigned int> group(vertexCount);
+	vector<unsigned int> groupSize(vertexCount, 0);
+	{
+		unordered_map<PositionKey, unsigned int, PositionKeyHash> seen;
+		seen.reserve(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			const V &v = vertices[i];
+			PositionKey key = { { v.Position.x, v.Position.y, v.Position.z } };
+			group[i] = seen.insert(make_pair(key, (unsigned int)i)).first->second;
+			if (wedge[i] == i)
+				groupSize[group[i]]++;
+		}
+	}
+	vector<unsigned char> locked(vertexCount, 0);
+	for (size_t i = 0; i < vertexCount; i++) {
+		if (groupSize[group[i]] > 1)
+			locked[group[i]] = 1;
+	}
+
+	vector<unsigned int> tris;
+	tris.reserve(indices.size());
+	for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+		unsigned int a = wedge[indices[i]], b = wedge[indices[i + 1]], c = wedge[indices[i + 2]];
+		if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+			continue;
+		tris.push_back(a); tris.push_back(b); tris.push_back(c);
+	}
+
+	// edges used by a single triangle are on an open border
+	{
+		unordered_map<uint64_t, unsigned int> edgeUse;
+		edgeUse.reserve(tris.size());
+		for (size_t t = 0; t < tris.size(); t += 3) {
+			for (int e = 0; e < 3; e++) {
+				uint64_t a = group[tris[t + e]], b = group[tris[t + (e + 1) % 3]];
+				edgeUse[a < b ? (a << 32 | b) : (b << 32 | a)]++;
+			}
+		}
+		for (auto it = edgeUse.begin(); it != edgeUse.end(); ++it) {
+			if (it->second == 1) {
+				locked[it->first >> 32] = 1;
+				locked[it->first & 0xffffffffu] = 1;
+			}
+		}
+	}
+
+	// area weighted plane quadrics, accumulated per position
+	vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < tris.size(); t += 3) {
+		vec3 p0 = vertices[tris[t]].Position, p1 = vertices[tris[t + 1]].Position, p2 = vertices[tris[t + 2]].Position;
+		vec3 n = triangleNormal(p0, p1, p2);
+		float area = length(n);
+		if (area == 0)
+			continue;
+		n /= area;
+		Quadric q(n.x, n.y, n.z, -dot(n, p0), area * 0.5);
+		for (int k = 0; k < 3; k++)
+			quadrics[group[tris[t + k]]].add(q);
+	}
+
+	double maxCost = double(targetError) * targetError;
+	size_t targetTriangles = targetIndexCount / 3;
+	vector<unsigned int> remap(vertexCount);
+	vector<unsigned char> dirty(vertexCount);
+	vector<vector<unsigned int>> vertexTris(vertexCount);
+	vector<Collapse> candidates;
+
+	for (int pass = 0; pass < 100 && tris.size() / 3 > targetTriangles; pass++) {
+		for (size_t i = 0; i < vertexCount; i++)
+			vertexTris[i].clear();
+		for (size_t t = 0; t < tris.size(); t += 3) {
+			for (int k = 0; k < 3; k++)
+				vertexTris[tris[t + k]].push_back((unsigned int)t);
+		}
+
+		candidates.clear();
+		for (size_t t = 0; t < tris.size(); t += 3) {
+			for (int e = 0; e < 3; e++) {
+				unsigned int a = tris[t + e], b = tris[t + (e + 1) % 3];
+				Quadric q = quadrics[group[a]];
+				q.add(quadrics[group[b]]);
+				if (!locked[group[a]]) {
+					Collapse c = { a, b, q.error(vertices[b].Position) };
+					candidates.push_back(c);
+				}
+				if (!locked[group[b]]) {
+					Collapse c = { b, a, q.error(vertices[a].Position) };
+					candidates.push_back(c);
+				}
+			}
+		}
+		sort(candidates.begin(), candidates.end());
+
+		// every interior collapse removes two triangles
+		size_t budget = (tris.size() / 3 - targetTriangles) / 2 + 1;
+		size_t collapsed = 0;
+		for (size_t i = 0; i < vertexCount; i++)
+			remap[i] = (unsigned int)i;
+		fill(dirty.begin(), dirty.end(), 0);
+
+		for (size_t i = 0; i < candidates.size() && collapsed < budget; i++) {
+			const Collapse &c = candidates[i];
+			if (c.cost > maxCost)
+				break;
+			if (dirty[group[c.from]] || dirty[group[c.to]])
+				continue;
+
+			// reject collapses that fold a surrounding triangle over
+			vec3 target = vertices[c.to].Position;
+			bool flips = false;
+			const vector<unsigned int> &around = vertexTris[c.from];
+			for (size_t k = 0; k < around.size() && !flips; k++) {
+				unsigned int t = around[k];
+				unsigned int v[3] = { tris[t], tris[t + 1], tris[t + 2] };
+				if (group[v[0]] == group[c.to] || group[v[1]] == group[c.to] || group[v[2]] == group[c.to])
+					continue;	// removed by this collapse
+				vec3 p[3], moved[3];
+				for (int j = 0; j < 3; j++) {
+					p[j] = vertices[v[j]].Position;
+					moved[j] = v[j] == c.from ? target : p[j];
+				}
+				vec3 before = triangleNormal(p[0], p[1], p[2]), after = triangleNormal(moved[0], moved[1], moved[2]);
+				if (dot(before, after) <= 0.25f * length(before) * length(after))
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			remap[c.from] = c.to;
+			quadrics[group[c.to]].add(quadrics[group[c.from]]);
+			for (size_t k = 0; k < around.size(); k++) {
+				for (int j = 0; j < 3; j++)
+					dirty[group[tris[around[k] + j]]] = 1;
+			}
+			collapsed++;
+		}
+		if (collapsed == 0)
+			break;
+
+		size_t write = 0;
+		for (size_t t = 0; t < tris.size(); t += 3) {
+			unsigned int a = remap[tris[t]], b = remap[tris[t + 1]], c = remap[tris[t + 2]];
+			if (group[a] == group[b] || group[b] == group[c] || group[a] == group[c])
+				continue;
+			tris[write++] = a; tris[write++] = b; tris[write++] = c;
+		}
+		tris.resize(write);
+	}
+
+	return tris;
+}
+
+// builds the coarser levels 1 .. LOD_COUNT - 1, each about half of the previous one;
+// levels that would not save at least a tenth of the previous level are left out
+template <typename V>
+vector<vector<unsigned int>> buildLods(const vector<V> &vertices, const vector<unsigned int> &indices)
+{
+	vector<vector<unsigned int>> lods;
+	lods.reserve(LOD_COUNT);	// previous points into it
+	if (indices.size() / 3 < LOD_MIN_TRIANGLES)
+		return lods;
+
+	vec3 lo = vertices[0].Position, hi = vertices[0].Position;
+	for (size_t i = 1; i < vertices.size(); i++) {
+		lo = glm::min(lo, vertices[i].Position);
+		hi = glm::max(hi, vertices[i].Position);
+	}
+	float extent = length(hi - lo);
+
+	const float errors[LOD_COUNT] = { 0.0f, 0.005f, 0.015f, 0.04f };
+	const vector<unsigned int> *previous = &indices;
+	for (int level = 1; level < LOD_COUNT; level++) {
+		vector<unsigned int> lod = simplifyMesh(vertices, *previous, previous->size() / 2, errors[level] * extent);
+		if (lod.size() * 10 > previous->size() * 9 || lod.empty())
+			break;
+		lods.push_back(lod);
+		previous = &lods.back();
+	}
+	return lods;
+}
+
+#endif
@@ -0,0 +1,634 @@
+#ifndef SOFTRASTER_H
+#define SOFTRASTER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh.h"
+#include "model.h"
+#include "culling.h"
+#include "threadpool.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define SOFTRASTER_SSE 1
+#endif
+
+using namespace std;
+using namespace glm;
+
+// the lamp uniforms render_scene / render_model give model_clustered.fs
+struct SoftLight {
+	vec3 position;
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+	float constant, linear, quadratic;
+	float shininess;
+
+	// the lamp term of the shader at a surface point; visibility scales all but the ambient
+	vec3 shade(const vec3 &point, const vec3 &normal, const vec3 &eye, const vec3 &albedo, const vec3 &specularMap,
+		float visibility = 1.0f) const
+	{
+		float normalLength = length(normal);
+		vec3 norm = normalLength > 0 ? normal / normalLength : vec3(0.0f);
+		vec3 viewDir = normalize(eye - point);
+		vec3 toLight = position - point;
+		float distance = length(toLight);
+		vec3 lightDir = distance > 0 ? toLight / distance : vec3(0.0f);
+
+		float diff = std::max(dot(norm, lightDir), 0.0f);
+		vec3 reflectDir = reflect(-lightDir, norm);
+		float spec = std::pow(std::max(dot(viewDir, reflectDir), 0.0f), shininess);
+		float attenuation = 1.0f / (constant + linear * distance + quadratic * (distance * distance));
+		return (ambient * albedo + visibility * (diffuse * diff * albedo + specular * spec * specularMap)) * attenuation;
+	}
+};
+
+// the first map of each kind, as texture_diffuse1 / texture_specular1 in the shader; NULL if missing
+inline void materialMaps(const Mesh &mesh, const TextureImage *&diffuseMap, const TextureImage *&specularMap)
+{
+	diffuseMap = specularMap = NULL;
+	for (unsigned int i = 0; i < mesh.textures.size(); i++) {
+		if (mesh.textures[i].type == "texture_diffuse" && !diffuseMap)
+			diffuseMap = cpuTexture(mesh.textures[i].id);
+		else if (mesh.textures[i].type == "texture_specular" && !specularMap)
+			specularMap = cpuTexture(mesh.textures[i].id);
+	}
+}
+
+// GL_REPEAT for a texel index
+inline int wrapTexel(int i, int n)
+{
+	i %= n;
+	return i < 0 ? i + n : i;
+}
+
+// bilinear with repeat, like the GL samplers without the mipmaps
+inline vec3 sampleTexture(const TextureImage &image, const vec2 &uv)
+{
+	float u = uv.x * image.width - 0.5f, v = uv.y * image.height - 0.5f;
+	float fu = std::floor(u), fv = std::floor(v);
+	float tu = u - fu, tv = v - fv;
+	int xa = wrapTexel((int)fu, image.width), xb = wrapTexel((int)fu + 1, image.width);
+	int ya = wrapTexel((int)fv, image.height), yb = wrapTexel((int)fv + 1, image.height);
+	const unsigned char *p00 = &image.rgba[((size_t)ya * image.width + xa) * 4];
+	const unsigned char *p10 = &image.rgba[((size_t)ya * image.width + xb) * 4];
+	const unsigned char *p01 = &image.rgba[((size_t)yb * image.width + xa) * 4];
+	const unsigned char *p11 = &image.rgba[((size_t)yb * image.width + xb) * 4];
+	vec3 c;
+	for (int i = 0; i < 3; i++) {
+		float top = p00[i] + (p10[i] - p00[i]) * tu;
+		float bottom = p01[i] + (p11[i] - p01[i]) * tu;
+		c[i] = (top + (bottom - top) * tv) * (1.0f / 255.0f);
+	}
+	return c;
+}
+
+// the gradient of sky.fs for a sky.obj without texture
+inline vec3 skyColour(const vec3 &direction)
+{
+	float h = normalize(direction).y;
+	vec3 zenith(0.25f, 0.45f, 0.85f);
+	vec3 horizon(0.75f, 0.80f, 0.90f);
+	vec3 ground(0.35f, 0.33f, 0.30f);
+	return h > 0 ? mix(horizon, zenith, std::pow(h, 0.6f)) : mix(horizon, ground, std::pow(-h, 0.4f));
+}
+
+// one RGBA8 pixel from a linear colour, clamped like the GL colour buffer
+inline void storeColour(unsigned char *p, const vec3 &c)
+{
+	p[0] = (unsigned char)(glm::clamp(c.x, 0.0f, 1.0f) * 255.0f + 0.5f);
+	p[1] = (unsigned char)(glm::clamp(c.y, 0.0f, 1.0f) * 255.0f + 0.5f);
+	p[2] = (unsigned char)(glm::clamp(c.z, 0.0f, 1.0f) * 255.0f + 0.5f);
+	p[3] = 255;
+}
+
+/*
+	CPU rasterizer backend for hosts without a usable GL driver.
+	A frame is a list of mesh draws seen from one or more views (the two eyes
+	side by side), rendered by render() in three parallel stages:
+		vertices  every vertex goes to world space once and then to the clip
+		          space of each view
+		setup     chunks of triangles are clipped against the near plane,
+		          taken to pixel space and binned into the TILE x TILE tiles
+		          their bounds touch
+		tiles     one job per tile walks its bins in submission order with
+		          4 pixel wide edge functions, a tile local depth buffer and
+		          the Phong lamp of model_clustered.fs per covered pixel
+	No two tiles share a pixel, so the last stage needs no locks at all.
+	Only the lamp lights the scene, the clustered point lights and the shadow
+	cube stay GPU features; pixels nothing covers get the analytic sky.
+*/
+class SoftwareRasterizer {
+public:
+	static const int TILE = 64;				// tile side in pixels, multiple of 4 for the SIMD rows
+	static const int VERTEX_CHUNK = 4096;	// vertices per transform job
+	static const int SETUP_CHUNK = 1024;	// triangles per setup job
+
+	int width, height;
+	vector<unsigned char> color;		// RGBA8, rows bottom-up like glReadPixels
+
+	// statistics of the last render()
+	size_t triangles;		// set up after culling and clipping
+	size_t tileRefs;		// triangle references in the tile bins
+	double vertexMs, setupMs, tileMs;
+
+	SoftwareRasterizer(int width, int height, ThreadPool &pool = workerPool())
+		: width(width), height(height), triangles(0), tileRefs(0), vertexMs(0), setupMs(0), tileMs(0), pool(pool), jobCount(0)
+	{
+		color.assign((size_t)width * height * 4, 0);
+	}
+
+	SoftwareRasterizer(const SoftwareRasterizer &) = delete;
+	SoftwareRasterizer &operator=(const SoftwareRasterizer &) = delete;
+
+	unsigned int threads() const { return pool.size(); }
+
+	// forgets the views and draws of the previous frame
+	void beginFrame()
+	{
+		views.clear();
+		draws.clear();
+	}
+
+	// viewport is (x, y, width, height) in the colour buffer, views must not overlap
+	void addView(const vec4 &viewport, const mat4 &view, const mat4 &projection, const vec3 &eye)
+	{
+		View v;
+		v.x = std::max(0, (int)viewport.x);
+		v.y = std::max(0, (int)viewport.y);
+		v.w = std::min(width, (int)viewport.x + (int)viewport.z) - v.x;
+		v.h = std::min(height, (int)viewport.y + (int)viewport.w) - v.y;
+		if (v.w <= 0 || v.h <= 0)
+			return;
+		// the GL viewport transform uses the requested rectangle, even where it is clamped
+		v.originX = viewport.x;
+		v.originY = viewport.y;
+		v.scaleX = viewport.z * 0.5f;
+		v.scaleY = viewport.w * 0.5f;
+		v.tilesX = (v.w + TILE - 1) / TILE;
+		v.tilesY = (v.h + TILE - 1) / TILE;
+		v.viewProjection = projection * view;
+		// the sky is drawn with the rotation of the view only, see sky.vs
+		v.skyInverse = inverse(projection * mat4(mat3(view)));
+		v.eye = eye;
+		views.push_back(v);
+	}
+
+	// a lit mesh, normalMatrix is the inverse transpose of model
+	void draw(const Mesh &mesh, const mat4 &model, const mat4 &normalMatrix, const SoftLight &light)
+	{
+		DrawCall call;
+		call.mesh = &mesh;
+		call.model = model;
+		call.normal = mat3(normalMatrix);
+		call.light = light;
+		call.lit = true;
+		call.colour = vec3(1.0f);
+		materialMaps(mesh, call.diffuseMap, call.specularMap);
+		draws.push_back(call);
+	}
+
+	// a mesh in one flat colour, for the lamp
+	void drawUnlit(const Mesh &mesh, const mat4 &model, const vec3 &colour)
+	{
+		DrawCall call;
+		call.mesh = &mesh;
+		call.model = model;
+		call.normal = mat3(1.0f);
+		call.lit = false;
+		call.colour = colour;
+		call.diffuseMap = call.specularMap = NULL;
+		draws.push_back(call);
+	}
+
+	// renders every queued draw into every view
+	void render()
+	{
+		typedef chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+		transformVertices();
+		Clock::time_point transformed = Clock::now();
+		setupTriangles();
+		Clock::time_point binned = Clock::now();
+		int tileCount = 0;
+		for (unsigned int v = 0; v < views.size(); v++) {
+			views[v].firstTile = tileCount;
+			tileCount += views[v].tilesX * views[v].tilesY;
+		}
+		pool.parallelFor(tileCount, [this](int tile) { renderTile(tile); });
+		Clock::time_point done = Clock::now();
+
+		vertexMs = chrono::duration<double, milli>(transformed - start).count();
+		setupMs = chrono::duration<double, milli>(binned - transformed).count();
+		tileMs = chrono::duration<double, milli>(done - binned).count();
+	}
+
+private:
+	struct View {
+		int x, y, w, h;					// pixels covered, clamped to the colour buffer
+		float originX, originY, scaleX, scaleY;
+		int tilesX, tilesY, firstTile;
+		int firstJob, endJob;			// its setup jobs
+		mat4 viewProjection;
+		mat4 skyInverse;
+		vec3 eye;
+	};
+
+	struct DrawCall {
+		const Mesh *mesh;
+		mat4 model;
+		mat3 normal;
+		SoftLight light;
+		bool lit;
+		vec3 colour;
+		const TextureImage *diffuseMap, *specularMap;
+		size_t firstVertex;				// in the transformed vertex arrays
+	};
+
+	struct WorldVertex {
+		vec3 position;
+		vec3 normal;
+		vec2 uv;
+	};
+
+	// a vertex while clipping
+	struct ClipVertex {
+		vec4 clip;
+		vec3 position;
+		vec3 normal;
+		vec2 uv;
+	};
+
+	// pixel space triangle, the attributes are premultiplied by 1/w for perspective correct interpolation
+	struct SetupTri {
+		float x[3], y[3], z[3], invW[3];
+		vec3 position[3];
+		vec3 normal[3];
+		vec2 uv[3];
+		int draw;
+	};
+
+	// a chunk of one draw's triangles in one view, with its own tile bins
+	struct SetupJob {
+		int view, draw;
+		size_t first, end;
+		vector<SetupTri> tris;
+		vector<ivec4> tileRange;		// x0, y0, x1, y1 of the tiles each triangle touches
+		vector<unsigned int> tileStart;	// per tile of the view, offsets into tileTris
+		vector<unsigned int> tileTris;
+	};
+
+	ThreadPool &pool;
+	vector<View> views;
+	vector<DrawCall> draws;
+	vector<WorldVertex> world;
+	vector<vector<vec4>> clip;			// per view, parallel to world
+	vector<SetupJob> jobs;
+	int jobCount;
+
+	void transformVertices()
+	{
+		size_t total = 0;
+		vector<ivec3> chunks;		// draw, first, end
+		for (unsigned int d = 0; d < draws.size(); d++) {
+			draws[d].firstVertex = total;
+			int count = (int)draws[d].mesh->vertices.size();
+			for (int first = 0; first < count; first += VERTEX_CHUNK)
+				chunks.push_back(ivec3(d, first, std::min(count, first + VERTEX_CHUNK)));
+			total += count;
+		}
+		world.resize(total);
+		clip.resize(views.size());
+		for (unsigned int v = 0; v < views.size(); v++)
+			clip[v].resize(total);
+
+		pool.parallelFor((int)chunks.size(), [&](int job) {
+			const DrawCall &call = draws[chunks[job].x];
+			const vector<Vertex> &vertices = call.mesh->vertices;
+			for (int i = chunks[job].y; i < chunks[job].z; i++) {
+				WorldVertex &out = world[call.firstVertex + i];
+				vec4 position = call.model * vec4(vertices[i].Position, 1.0f);
+				out.position = vec3(position);
+				out.normal = call.normal * vertices[i].Normal;
+				out.uv = vertices[i].TexCoords;
+				for (unsigned int v = 0; v < views.size(); v++)
+					clip[v][call.firstVertex + i] = views[v].viewProjection * position;
+			}
+		});
+	}
+
+	void setupTriangles()
+	{
+		// a job per chunk of every draw whose bounds touch the view, grouped by view
+		jobCount = 0;
+		for (unsigned int v = 0; v < views.size(); v++) {
+			View &view = views[v];
+			Frustum frustum(view.viewProjection);
+			view.firstJob = jobCount;
+			for (unsigned int d = 0; d < draws.size(); d++) {
+				BoundingSphere sphere = sphereOf(transformAABB(draws[d].mesh->bounds, draws[d].model));
+				if (!frustum.testSphere(sphere.center, sphere.radius))
+					continue;
+				size_t count = draws[d].mesh->indices.size() / 3;
+				for (size_t first = 0; first < count; first += SETUP_CHUNK) {
+					if (jobCount == (int)jobs.size())
+						jobs.push_back(SetupJob());
+					SetupJob &job = jobs[jobCount++];
+					job.view = v;
+					job.draw = d;
+					job.first = first;
+					job.end = std::min(count, first + SETUP_CHUNK);
+				}
+			}
+			view.endJob = jobCount;
+		}
+
+		pool.parallelFor(jobCount, [this](int index) {
+			SetupJob &job = jobs[index];
+			const View &view = views[job.view];
+			const DrawCall &call = draws[job.draw];
+			const vector<unsigned int> &indices = call.mesh->indices;
+			job.tris.clear();
+			job.tileRange.clear();
+			for (size_t t = job.first; t < job.end; t++)
+				setupTriangle(view, job, call.firstVertex + indices[3 * t], call.firstVertex + indices[3 * t + 1],
+					call.firstVertex + indices[3 * t + 2]);
+
+			// counting sort of the triangles into the tiles they touch
+			int tiles = view.tilesX * view.tilesY;
+			job.tileStart.assign(tiles + 1, 0);
+			for (unsigned int i = 0; i < job.tileRange.size(); i++) {
+				const ivec4 &r = job.tileRange[i];
+				for (int ty = r.y; ty <= r.w; ty++) {
+					for (int tx = r.x; tx <= r.z; tx++)
+						job.tileStart[ty * view.tilesX + tx + 1]++;
+				}
+			}
+			for (int i = 0; i < tiles; i++)
+				job.tileStart[i + 1] += job.tileStart[i];
+			job.tileTris.resize(job.tileStart[tiles]);
+			vector<unsigned int> fill(job.tileStart.begin(), job.tileStart.end() - 1);
+			for (unsigned int i = 0; i < job.tileRange.size(); i++) {
+				const ivec4 &r = job.tileRange[i];
+				for (int ty = r.y; ty <= r.w; ty++) {
+					for (int tx = r.x; tx <= r.z; tx++)
+						job.tileTris[fill[ty * view.tilesX + tx]++] = i;
+				}
+			}
+		});
+
+		triangles = tileRefs = 0;
+		for (int i = 0; i < jobCount; i++) {
+			triangles += jobs[i].tris.size();
+			tileRefs += jobs[i].tileTris.size();
+		}
+	}
+
+	ClipVertex clipVertex(int view, size_t index) const
+	{
+		ClipVertex v;
+		v.clip = clip[view][index];
+		v.position = world[index].position;
+		v.normal = world[index].normal;
+		v.uv = world[index].uv;
+		return v;
+	}
+
+	static ClipVertex lerp(const ClipVertex &p, const ClipVertex &q, float t)
+	{
+		ClipVertex v;
+		v.clip = p.clip + (q.clip - p.clip) * t;
+		v.position = p.position + (q.position - p.position) * t;
+		v.normal = p.normal + (q.normal - p.normal) * t;
+		v.uv = p.uv + (q.uv - p.uv) * t;
+		return v;
+	}
+
+	void setupTriangle(const View &view, SetupJob &job, size_t i0, size_t i1, size_t i2)
+	{
+		int viewIndex = job.view;
+		const vec4 &a = clip[viewIndex][i0], &b = clip[viewIndex][i1], &c = clip[viewIndex][i2];
+		// trivially outside one of the side planes or the far plane
+		if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+			(a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+			(a.z > a.w && b.z > b.w && c.z > c.w))
+			return;
+
+		// Sutherland-Hodgman against the near plane z = -w, carrying the attributes along
+		ClipVertex in[3] = { clipVertex(viewIndex, i0), clipVertex(viewIndex, i1), clipVertex(viewIndex, i2) };
+		ClipVertex poly[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++) {
+			const ClipVertex &p = in[i], &q = in[(i + 1) % 3];
+			float dp = p.clip.z + p.clip.w, dq = q.clip.z + q.clip.w;
+			if (dp >= 0)
+				poly[count++] = p;
+			if ((dp >= 0) != (dq >= 0))
+				poly[count++] = lerp(p, q, dp / (dp - dq));
+		}
+		if (count < 3)
+			return;
+
+		float sx[4], sy[4], sz[4], iw[4];
+		for (int i = 0; i < count; i++) {
+			iw[i] = 1.0f / std::max(poly[i].clip.w, 1e-6f);
+			sx[i] = view.originX + (poly[i].clip.x * iw[i] + 1.0f) * view.scaleX;
+			sy[i] = view.originY + (poly[i].clip.y * iw[i] + 1.0f) * view.scaleY;
+			sz[i] = std::max(0.0f, poly[i].clip.z * iw[i] * 0.5f + 0.5f);
+		}
+		for (int i = 1; i + 1 < count; i++) {
+			int id[3] = { 0, i, i + 1 };
+			// both windings are drawn, like the GL path without face culling; make the area positive
+			float area = (sx[id[1]] - sx[id[0]]) * (sy[id[2]] - sy[id[0]]) - (sy[id[1]] - sy[id[0]]) * (sx[id[2]] - sx[id[0]]);
+			if (area == 0 || area != area)
+				continue;
+			if (area < 0)
+				std::swap(id[1], id[2]);
+
+			float xmin = std::min(sx[id[0]], std::min(sx[id[1]], sx[id[2]]));
+			float xmax = std::max(sx[id[0]], std::max(sx[id[1]], sx[id[2]]));
+			float ymin = std::min(sy[id[0]], std::min(sy[id[1]], sy[id[2]]));
+			float ymax = std::max(sy[id[0]], std::max(sy[id[1]], sy[id[2]]));
+			if (xmax < view.x || ymax < view.y || xmin >= view.x + view.w || ymin >= view.y + view.h)
+				continue;
+			ivec4 range;
+			range.x = (int)(std::max(xmin, (float)view.x) - view.x) / TILE;
+			range.y = (int)(std::max(ymin, (float)view.y) - view.y) / TILE;
+			range.z = std::min((int)(std::min(xmax, (float)(view.x + view.w - 1)) - view.x) / TILE, view.tilesX - 1);
+			range.w = std::min((int)(std::min(ymax, (float)(view.y + view.h - 1)) - view.y) / TILE, view.tilesY - 1);
+
+			SetupTri tri;
+			for (int k = 0; k < 3; k++) {
+				const ClipVertex &v = poly[id[k]];
+				float w = iw[id[k]];
+				tri.x[k] = sx[id[k]];
+				tri.y[k] = sy[id[k]];
+				tri.z[k] = sz[id[k]];
+				tri.invW[k] = w;
+				tri.position[k] = v.position * w;
+				tri.normal[k] = v.normal * w;
+				tri.uv[k] = v.uv * w;
+			}
+			tri.draw = job.draw;
+			job.tris.push_back(tri);
+			job.tileRange.push_back(range);
+		}
+	}
+
+	void renderTile(int tile)
+	{
+		int viewIndex = 0;
+		while (viewIndex + 1 < (int)views.size() && tile >= views[viewIndex + 1].firstTile)
+			viewIndex++;
+		const View &view = views[viewIndex];
+		int local = tile - view.firstTile;
+		int x0 = view.x + (local % view.tilesX) * TILE;
+		int y0 = view.y + (local / view.tilesX) * TILE;
+		int x1 = std::min(x0 + TILE, view.x + view.w);
+		int y1 = std::min(y0 + TILE, view.y + view.h);
+
+		float depth[TILE * TILE];
+		std::fill(depth, depth + TILE * TILE, 1.0f);
+
+		for (int j = view.firstJob; j < view.endJob; j++) {
+			const SetupJob &job = jobs[j];
+			for (unsigned int k = job.tileStart[local]; k < job.tileStart[local + 1]; k++)
+				rasterizeTriangle(view, job.tris[job.tileTris[k]], x0, y0, x1, y1, depth);
+		}
+
+		// the sky where nothing was drawn
+		for (int y = y0; y < y1; y++) {
+			for (int x = x0; x < x1; x++) {
+				if (depth[(y - y0) * TILE + x - x0] < 1.0f)
+					continue;
+				vec4 direction = view.skyInverse * vec4((x + 0.5f - view.originX) / view.scaleX - 1.0f,
+					(y + 0.5f - view.originY) / view.scaleY - 1.0f, 1.0f, 1.0f);
+				store(x, y, skyColour(vec3(direction)));
+			}
+		}
+	}
+
+	void rasterizeTriangle(const View &view, const SetupTri &tri, int x0, int y0, int x1, int y1, float *depth)
+	{
+		float fxmin = std::min(tri.x[0], std::min(tri.x[1], tri.x[2]));
+		float fxmax = std::max(tri.x[0], std::max(tri.x[1], tri.x[2]));
+		float fymin = std::min(tri.y[0], std::min(tri.y[1], tri.y[2]));
+		float fymax = std::max(tri.y[0], std::max(tri.y[1], tri.y[2]));
+		// tile local pixel bounds, x starts on a multiple of 4 from the tile corner
+		int xmin = ((int)std::floor(std::max(fxmin, (float)x0)) - x0) & ~3;
+		int xmax = (int)std::ceil(std::min(fxmax, (float)x1)) - x0;
+		int ymin = (int)std::floor(std::max(fymin, (float)y0)) - y0;
+		int ymax = (int)std::ceil(std::min(fymax, (float)y1)) - y0;
+		if (xmin >= xmax || ymin >= ymax)
+			return;
+
+		// edge functions e_i(x, y) = A_i x + B_i y + C_i relative to the tile corner, positive inside;
+		// the constant terms in double keep large triangles near the eye exact enough
+		float A[3], B[3], C[3];
+		for (int i = 0; i < 3; i++) {
+			int j = (i + 1) % 3;
+			double xi = (double)tri.x[i] - x0, yi = (double)tri.y[i] - y0;
+			double xj = (double)tri.x[j] - x0, yj = (double)tri.y[j] - y0;
+			A[i] = float(yi - yj);
+			B[i] = float(xj - xi);
+			C[i] = float(xi * yj - xj * yi);
+		}
+		float area = C[0] + C[1] + C[2];
+		if (area <= 0)
+			return;
+		float invArea = 1.0f / area;
+		// depth as a plane over the barycentrics: e1 weights vertex 0, e2 vertex 1, e0 vertex 2
+		float za = (tri.z[0] * A[1] + tri.z[1] * A[2] + tri.z[2] * A[0]) * invArea;
+		float zb = (tri.z[0] * B[1] + tri.z[1] * B[2] + tri.z[2] * B[0]) * invArea;
+		float zc = (tri.z[0] * C[1] + tri.z[1] * C[2] + tri.z[2] * C[0]) * invArea;
+
+#ifdef SOFTRASTER_SSE
+		const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 right = _mm_set1_ps(float(xmax));
+		__m128 a0 = _mm_set1_ps(A[0]), a1 = _mm_set1_ps(A[1]), a2 = _mm_set1_ps(A[2]), az = _mm_set1_ps(za);
+		for (int y = ymin; y < ymax; y++) {
+			float py = y + 0.5f;
+			__m128 r0 = _mm_set1_ps(B[0] * py + C[0]);
+			__m128 r1 = _mm_set1_ps(B[1] * py + C[1]);
+			__m128 r2 = _mm_set1_ps(B[2] * py + C[2]);
+			__m128 rz = _mm_set1_ps(zb * py + zc);
+			float *row = depth + y * TILE;
+			for (int x = xmin; x < xmax; x += 4) {
+				__m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), r0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, px), r1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), r2);
+				__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+				inside = _mm_and_ps(inside, _mm_cmplt_ps(px, right));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+				__m128 z = _mm_add_ps(_mm_mul_ps(az, px), rz);
+				int mask = _mm_movemask_ps(_mm_and_ps(inside, _mm_cmplt_ps(z, _mm_loadu_ps(row + x))));
+				if (mask == 0)
+					continue;
+				float w0[4], w1[4], w2[4], depths[4];
+				_mm_storeu_ps(w0, e1);
+				_mm_storeu_ps(w1, e2);
+				_mm_storeu_ps(w2, e0);
+				_mm_storeu_ps(depths, z);
+				for (int lane = 0; lane < 4; lane++) {
+					if (!(mask & (1 << lane)))
+						continue;
+					row[x + lane] = depths[lane];
+					store(x0 + x + lane, y0 + y, shade(view, tri, w0[lane] * invArea, w1[lane] * invArea, w2[lane] * invArea));
+				}
+			}
+		}
+#else
+		for (int y = ymin; y < ymax; y++) {
+			float py = y + 0.5f;
+			float *row = depth + y * TILE;
+			for (int x = xmin; x < xmax; x++) {
+				float px = x + 0.5f;
+				float e0 = A[0] * px + B[0] * py + C[0];
+				float e1 = A[1] * px + B[1] * py + C[1];
+				float e2 = A[2] * px + B[2] * py + C[2];
+				if (e0 < 0 || e1 < 0 || e2 < 0)
+					continue;
+				float z = za * px + zb * py + zc;
+				if (!(z < row[x]))
+					continue;
+				row[x] = z;
+				store(x0 + x, y0 + y, shade(view, tri, e1 * invArea, e2 * invArea, e0 * invArea));
+			}
+		}
+#endif
+	}
+
+	// model_clustered.fs for the lamp, l0..l2 are the screen space barycentrics
+	vec3 shade(const View &view, const SetupTri &tri, float l0, float l1, float l2) const
+	{
+		const DrawCall &call = draws[tri.draw];
+		if (!call.lit)
+			return call.colour;
+
+		float w = 1.0f / (l0 * tri.invW[0] + l1 * tri.invW[1] + l2 * tri.invW[2]);
+		vec3 position = (tri.position[0] * l0 + tri.position[1] * l1 + tri.position[2] * l2) * w;
+		vec3 normal = tri.normal[0] * l0 + tri.normal[1] * l1 + tri.normal[2] * l2;
+		vec2 uv = (tri.uv[0] * l0 + tri.uv[1] * l1 + tri.uv[2] * l2) * w;
+
+		// missing maps: white albedo, no specular
+		vec3 albedo = call.diffuseMap ? sampleTexture(*call.diffuseMap, uv) : vec3(1.0f);
+		vec3 specularMap = call.specularMap ? sampleTexture(*call.specularMap, uv) : vec3(0.0f);
+		return call.light.shade(position, normal, view.eye, albedo, specularMap);
+	}
+
+	void store(int x, int y, const vec3 &c)
+	{
+		storeColour(&color[((size_t)y * width + x) * 4], c);
+	}
+};
+
+#endif
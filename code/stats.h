@@ -0,0 +1,158 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// what the render path submitted, counted where it is submitted (Mesh, Shader, the passes)
+struct RenderCounters {
+	unsigned int drawCalls = 0;
+	size_t triangles = 0;
+	unsigned int programBinds = 0;
+	unsigned int textureBinds = 0;
+	unsigned int vaoBinds = 0;
+	unsigned int uniformUpdates = 0;
+	size_t bytesUploaded = 0;
+	unsigned int objectsCulled = 0;		// whole objects dropped by select_visible
+	unsigned int meshesCulled = 0;		// meshes of drawn objects dropped by Model::Draw
+
+	void add(const RenderCounters &other)
+	{
+		drawCalls += other.drawCalls;
+		triangles += other.triangles;
+		programBinds += other.programBinds;
+		textureBinds += other.textureBinds;
+		vaoBinds += other.vaoBinds;
+		uniformUpdates += other.uniformUpdates;
+		bytesUploaded += other.bytesUploaded;
+		objectsCulled += other.objectsCulled;
+		meshesCulled += other.meshesCulled;
+	}
+};
+
+enum StatsPart {
+	STATS_SHARED,		// work done once per frame, before the eyes (transforms, shadow cube)
+	STATS_LEFT,
+	STATS_RIGHT,
+	STATS_PARTS
+};
+
+/*
+	Per frame render counters, split into the shared work and each eye.
+	The render path adds to counters(), which is the part being drawn;
+	render_stereo_eye switches it with setPart. endFrame keeps the finished
+	frame in last[] for the HUD and, while a CSV file is open, writes one
+	row per part to it, so two runs of a path can be compared after a scene
+	change. Main thread only, like the GL calls being counted.
+*/
+class RenderStats {
+public:
+	RenderCounters last[STATS_PARTS];		// of the last finished frame
+	int frames;
+
+	RenderStats() : frames(0), part(STATS_SHARED), rows(0) {}
+
+	~RenderStats()
+	{
+		stopCsv();
+	}
+
+	RenderStats(const RenderStats &) = delete;
+	RenderStats &operator=(const RenderStats &) = delete;
+
+	RenderCounters &counters() { return current[part]; }
+
+	void setPart(int newPart) { part = newPart; }
+
+	void beginFrame()
+	{
+		for (int i = 0; i < STATS_PARTS; i++)
+			current[i] = RenderCounters();
+		part = STATS_SHARED;
+	}
+
+	void endFrame()
+	{
+		for (int i = 0; i < STATS_PARTS; i++) {
+			last[i] = current[i];
+			if (csv.is_open())
+				writeRow(i);
+		}
+		part = STATS_SHARED;
+		frames++;
+	}
+
+	// all parts of the last frame
+	RenderCounters lastTotal() const
+	{
+		RenderCounters total;
+		for (int i = 0; i < STATS_PARTS; i++)
+			total.add(last[i]);
+		return total;
+	}
+
+	// starts writing a row per part of every frame to path, truncating it
+	bool startCsv(const string &path)
+	{
+		stopCsv();
+		csv.open(path.c_str());
+		if (!csv) {
+			cout << "ERROR::STATS:: cannot write " << path << endl;
+			return false;
+		}
+		csvPath = path;
+		rows = 0;
+		csv << "frame,part,draw_calls,triangles,program_binds,texture_binds,vao_binds,uniform_updates,"
+			"bytes_uploaded,objects_culled,meshes_culled\n";
+		return true;
+	}
+
+	void stopCsv()
+	{
+		if (!csv.is_open())
+			return;
+		csv.close();
+		cout << "* stats: " << rows << " rows written to " << csvPath << endl;
+	}
+
+	bool recording() const { return csv.is_open(); }
+
+	static const char *partName(int part)
+	{
+		const char *names[STATS_PARTS] = { "shared", "left", "right" };
+		return names[part];
+	}
+
+private:
+	RenderCounters current[STATS_PARTS];
+	int part;
+	ofstream csv;
+	string csvPath;
+	size_t rows;
+
+	void writeRow(int i)
+	{
+		const RenderCounters &c = last[i];
+		csv << frames << ',' << partName(i) << ',' << c.drawCalls << ',' << c.triangles << ',' << c.programBinds << ','
+			<< c.textureBinds << ',' << c.vaoBinds << ',' << c.uniformUpdates << ',' << c.bytesUploaded << ','
+			<< c.objectsCulled << ',' << c.meshesCulled << '\n';
+		rows++;
+	}
+};
+
+inline RenderStats &renderStats()
+{
+	static RenderStats stats;
+	return stats;
+}
+
+// the counters of the part being drawn
+inline RenderCounters &renderCounters()
+{
+	return renderStats().counters();
+}
+
+#endif
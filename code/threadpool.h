@@ -0,0 +1,122 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "trace.h"
+
+using namespace std;
+
+/*
+	Fixed set of worker threads for data parallel loops.
+	parallelFor hands out job indices through an atomic counter; the calling
+	thread works on them too and returns only when every job has finished.
+	Calls must not be nested.
+*/
+class ThreadPool {
+public:
+	ThreadPool(unsigned int count = thread::hardware_concurrency())
+	{
+		if (count < 1)
+			count = 1;
+		// the calling thread is the last worker
+		for (unsigned int i = 0; i + 1 < count; i++)
+			workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+
+	~ThreadPool()
+	{
+		{
+			lock_guard<mutex> lock(mtx);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+	}
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool &operator=(const ThreadPool &) = delete;
+
+	unsigned int size() const { return (unsigned int)workers.size() + 1; }
+
+	void parallelFor(int count, const function<void(int)> &job)
+	{
+		if (count <= 0)
+			return;
+		if (count == 1 || workers.empty()) {
+			for (int i = 0; i < count; i++)
+				job(i);
+			return;
+		}
+
+		{
+			lock_guard<mutex> lock(mtx);
+			current = &job;
+			jobCount = count;
+			next = 0;
+			busy = (int)workers.size();
+			generation++;
+		}
+		wake.notify_all();
+
+		runJobs();
+
+		unique_lock<mutex> lock(mtx);
+		done.wait(lock, [this] { return busy == 0; });
+		current = nullptr;
+	}
+
+private:
+	vector<thread> workers;
+	mutex mtx;
+	condition_variable wake, done;
+	const function<void(int)> *current = nullptr;
+	int jobCount = 0;
+	atomic<int> next;
+	int busy = 0;
+	unsigned int generation = 0;
+	bool stopping = false;
+
+	void runJobs()
+	{
+		TRACE_SCOPE("parallelFor");
+		for (int i = next++; i < jobCount; i = next++)
+			(*current)(i);
+	}
+
+	void workerLoop()
+	{
+		TRACE_THREAD_NAME("worker");
+		unsigned int seen = 0;
+		for (;;) {
+			{
+				unique_lock<mutex> lock(mtx);
+				wake.wait(lock, [&] { return stopping || generation != seen; });
+				if (stopping)
+					return;
+				seen = generation;
+			}
+			runJobs();
+			{
+				lock_guard<mutex> lock(mtx);
+				busy--;
+			}
+			done.notify_one();
+		}
+	}
+};
+
+// pool shared by the CPU side subsystems (occlusion, light binning, ...)
+inline ThreadPool &workerPool()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+#endif
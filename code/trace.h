@@ -0,0 +1,286 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+
+#if defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define TRACE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define TRACE_TSC 1
+#endif
+
+using namespace std;
+
+/*
+	Timeline of what every thread did, written as Chrome trace JSON (load it
+	in chrome://tracing or ui.perfetto.dev). Built with -DTRACING only;
+	without it the TRACE_* macros expand to nothing. A TRACE_SCOPE records
+	one complete event (name, start, duration) when its block ends. Every
+	thread appends to its own buffer, a list of fixed size chunks: the
+	owner writes an event and then publishes the new count with a release
+	store, so dump() can read any thread's buffer at any time without a
+	lock and the owner never waits. Only a thread's first event takes the
+	registry lock. An event costs two clock reads and a 32 byte store; on
+	x86 the clock is the time stamp counter, a few ns against some tens for
+	the system clock, and dump() converts it with the rate it measured
+	against the steady clock since the tracer started.
+	Names must be string literals; a detail (a file name) must live until
+	the block ends, its last 39 characters are copied.
+	Past MAX_CHUNKS per thread events are dropped and counted.
+*/
+#ifdef TRACING
+
+struct TraceEvent {
+	const char *name;
+	uint64_t start;			// ticks since the tracer started
+	uint64_t duration;		// ticks
+	const char *detail;		// a copy in the buffer's text blocks, or NULL
+};
+
+class TraceBuffer {
+public:
+	static const int CHUNK = 8192;			// events per chunk
+	static const int MAX_CHUNKS = 256;
+	static const int DETAIL = 39;			// characters kept of a detail
+	static const int TEXT_BLOCK = 4096;
+
+	int thread;				// index in the trace
+	string name;
+	atomic<size_t> dropped;
+
+	TraceBuffer(int thread) : thread(thread), name("thread " + to_string(thread)), dropped(0), chunks(1), textUsed(TEXT_BLOCK)
+	{
+		head = tail = new Chunk();
+	}
+
+	TraceBuffer(const TraceBuffer &) = delete;
+	TraceBuffer &operator=(const TraceBuffer &) = delete;
+
+	// owner thread only
+	void record(const char *name, uint64_t start, uint64_t duration, const char *detail)
+	{
+		int count = tail->count.load(memory_order_relaxed);
+		if (count == CHUNK) {
+			if (chunks == MAX_CHUNKS) {
+				dropped.fetch_add(1, memory_order_relaxed);
+				return;
+			}
+			Chunk *chunk = new Chunk();
+			tail->next.store(chunk, memory_order_release);
+			tail = chunk;
+			chunks++;
+			count = 0;
+		}
+		TraceEvent &event = tail->events[count];
+		event.name = name;
+		event.start = start;
+		event.duration = duration;
+		event.detail = detail ? copy(detail) : NULL;
+		tail->count.store(count + 1, memory_order_release);
+	}
+
+	// any thread: calls visit for every published event
+	template <class Visit>
+	void forEach(Visit visit) const
+	{
+		for (const Chunk *chunk = head; chunk; chunk = chunk->next.load(memory_order_acquire)) {
+			int count = chunk->count.load(memory_order_acquire);
+			for (int i = 0; i < count; i++)
+				visit(chunk->events[i]);
+		}
+	}
+
+private:
+	struct Chunk {
+		TraceEvent events[CHUNK];
+		atomic<int> count;
+		atomic<Chunk*> next;
+		Chunk() : count(0), next(nullptr) {}
+	};
+
+	Chunk *head, *tail;		// tail belongs to the owner
+	int chunks;
+	// the details; a block is never moved or freed, so a published event may point into it
+	vector<char*> text;
+	int textUsed;
+
+	const char *copy(const char *detail)
+	{
+		// the end of a path says the most
+		size_t length = strlen(detail);
+		if (length > DETAIL) {
+			detail += length - DETAIL;
+			length = DETAIL;
+		}
+		if (textUsed + length + 1 > TEXT_BLOCK) {
+			text.push_back(new char[TEXT_BLOCK]);
+			textUsed = 0;
+		}
+		char *copied = text.back() + textUsed;
+		memcpy(copied, detail, length);
+		copied[length] = 0;
+		textUsed += (int)length + 1;
+		return copied;
+	}
+};
+
+class Tracer {
+public:
+	Tracer() : origin(chrono::steady_clock::now()), originTicks(ticks()), path("trace.json") {}
+
+	// at exit; the buffers are left to the process, a worker may still hold one
+	~Tracer()
+	{
+		dump();
+	}
+
+	Tracer(const Tracer &) = delete;
+	Tracer &operator=(const Tracer &) = delete;
+
+	// ticks since the tracer started
+	uint64_t now() const
+	{
+		return ticks() - originTicks;
+	}
+
+	// the calling thread's buffer, registered on its first event
+	TraceBuffer &local()
+	{
+		static thread_local TraceBuffer *buffer = nullptr;
+		if (!buffer) {
+			lock_guard<mutex> lock(registry);
+			buffer = new TraceBuffer((int)buffers.size());
+			buffers.push_back(buffer);
+		}
+		return *buffer;
+	}
+
+	// names the calling thread in the trace
+	void nameThread(const char *name)
+	{
+		TraceBuffer &buffer = local();
+		lock_guard<mutex> lock(registry);
+		buffer.name = name;
+	}
+
+	// writes everything recorded so far, the threads go on recording meanwhile
+	bool dump()
+	{
+		lock_guard<mutex> lock(registry);
+		ofstream out(path.c_str());
+		if (!out) {
+			cout << "ERROR::TRACE:: cannot write " << path << endl;
+			return false;
+		}
+		// microseconds per tick, as they went since the start
+		double elapsed = chrono::duration<double, micro>(chrono::steady_clock::now() - origin).count();
+		uint64_t elapsedTicks = now();
+		double scale = elapsedTicks > 0 ? elapsed / elapsedTicks : 0.0;
+
+		size_t events = 0, dropped = 0;
+		out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+		bool first = true;
+		char line[160];
+		for (unsigned int b = 0; b < buffers.size(); b++) {
+			const TraceBuffer &buffer = *buffers[b];
+			out << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.thread
+				<< ",\"args\":{\"name\":\"" << escape(buffer.name.c_str()) << "\"}}";
+			first = false;
+			buffer.forEach([&](const TraceEvent &event) {
+				snprintf(line, sizeof(line), ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+					buffer.thread, event.start * scale, event.duration * scale);
+				out << line << escape(event.name) << "\"";
+				if (event.detail)
+					out << ",\"args\":{\"detail\":\"" << escape(event.detail) << "\"}";
+				out << "}";
+				events++;
+			});
+			dropped += buffer.dropped.load(memory_order_relaxed);
+		}
+		out << "\n]}\n";
+		cout << "* trace: " << events << " events of " << buffers.size() << " threads written to " << path;
+		if (dropped)
+			cout << ", " << dropped << " dropped";
+		cout << endl;
+		return true;
+	}
+
+private:
+	chrono::steady_clock::time_point origin;
+	uint64_t originTicks;
+	mutex registry;
+	vector<TraceBuffer*> buffers;
+	string path;
+
+	static uint64_t ticks()
+	{
+#ifdef TRACE_TSC
+		return __rdtsc();
+#else
+		return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	static string escape(const char *text)
+	{
+		string escaped;
+		for (const char *c = text; *c; c++) {
+			if (*c == '"' || *c == '\\')
+				escaped += '\\';
+			if ((unsigned char)*c >= 0x20)
+				escaped += *c;
+		}
+		return escaped;
+	}
+};
+
+inline Tracer &tracer()
+{
+	static Tracer instance;
+	return instance;
+}
+
+// records the rest of the enclosing block as one event of the calling thread
+class TraceScope {
+public:
+	TraceScope(const char *name, const char *detail = nullptr) : name(name), detail(detail), start(tracer().now()) {}
+
+	~TraceScope()
+	{
+		Tracer &trace = tracer();
+		trace.local().record(name, start, trace.now() - start, detail);
+	}
+
+	TraceScope(const TraceScope &) = delete;
+	TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+	const char *name, *detail;
+	uint64_t start;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+#define TRACE_SCOPE_DETAIL(name, detail) TraceScope TRACE_JOIN(traceScope, __LINE__)(name, detail)
+#define TRACE_THREAD_NAME(name) tracer().nameThread(name)
+#define TRACE_DUMP() tracer().dump()
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SCOPE_DETAIL(name, detail)
+#define TRACE_THREAD_NAME(name)
+#define TRACE_DUMP()
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "shader.h"
+#include "memtrack.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <iostream>
+
+using namespace std;
+using namespace glm;
+
+// GL 4.4 / ARB_buffer_storage, not part of the 3.3 loader
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC_RING)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+/*
+	Per draw transforms of a frame in one uniform buffer.
+	The buffer is split into SEGMENTS parts used round robin: the CPU writes
+	the model and normal matrices of every object into one segment while the
+	GPU may still read the previous ones, and a fence per segment tells when
+	it can be written again. With ARB_buffer_storage the whole buffer stays
+	mapped persistently; without it each segment is mapped unsynchronized for
+	the writes, the fences make that safe too.
+	Shaders read the slot bound to the Transform block (see attach).
+*/
+class TransformRing {
+public:
+	static const int SEGMENTS = 3;
+	static const GLuint BINDING = 1;
+	static const size_t SLOT_BYTES = 2 * sizeof(mat4);	// model, normal matrix (std140)
+
+	int waits;		// frames that found their segment still in use by the GPU
+
+	TransformRing() : waits(0), ready(false), persistent(false), buffer(0), mapped(NULL),
+		capacity(0), segment(0), used(0), memory("transform ring")
+	{
+		for (int i = 0; i < SEGMENTS; i++)
+			fences[i] = 0;
+	}
+
+	// load is the same proc address function glad was loaded with
+	void setup(GLADloadproc load)
+	{
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		stride = (SLOT_BYTES + alignment - 1) / alignment * alignment;
+
+		bufferStorage = NULL;
+		if (hasBufferStorage())
+			bufferStorage = (PFNGLBUFFERSTORAGEPROC_RING)load("glBufferStorage");
+		persistent = bufferStorage != NULL;
+		ready = true;
+	}
+
+	bool isPersistent() const { return persistent; }
+
+	// connects the shader's Transform block to the ring
+	void attach(const Shader &shader) const
+	{
+		GLuint block = glGetUniformBlockIndex(shader.ID, "Transform");
+		if (block != GL_INVALID_INDEX)
+			glUniformBlockBinding(shader.ID, block, BINDING);
+	}
+
+	// starts writing the next segment, with room for count transforms
+	void beginFrame(size_t count)
+	{
+		if (count > capacity)
+			allocate(std::max(count, 2 * capacity));
+
+		segment = (segment + 1) % SEGMENTS;
+		used = 0;
+		waitFence(segment);
+
+		if (persistent) {
+			writing = mapped + segment * segmentBytes();
+		}
+		else {
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			writing = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, segment * segmentBytes(), segmentBytes(),
+				GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+	}
+
+	// writes one transform, returns its slot for bind
+	int push(const mat4 &model)
+	{
+		return push(model, mat4(transpose(inverse(mat3(model)))));
+	}
+
+	// with a normal matrix the caller already has
+	int push(const mat4 &model, const mat4 &normalMatrix)
+	{
+		if (used >= capacity)
+			return -1;
+		unsigned char *slot = writing + used * stride;
+		memcpy(slot, value_ptr(model), sizeof(mat4));
+		memcpy(slot + sizeof(mat4), value_ptr(normalMatrix), sizeof(mat4));
+		return (int)used++;
+	}
+
+	// all transforms of the frame are written, before the first draw
+	void endWrites()
+	{
+		renderCounters().bytesUploaded += used * stride;
+		if (!persistent) {
+			glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		writing = NULL;
+	}
+
+	// selects the transform for the following draws
+	void bind(int slot) const
+	{
+		if (slot < 0)
+			return;
+		glBindBufferRange(GL_UNIFORM_BUFFER, BINDING, buffer, segment * segmentBytes() + slot * stride, SLOT_BYTES);
+	}
+
+	// after the last draw reading the segment
+	void endFrame()
+	{
+		if (fences[segment])
+			glDeleteSync(fences[segment]);
+		fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	// deletes the buffer and the fences while the context still exists; setup has to be called again before reuse
+	void release()
+	{
+		for (int i = 0; i < SEGMENTS; i++) {
+			if (fences[i])
+				glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+		if (buffer) {
+			if (persistent) {
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+				glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &buffer);
+		}
+		buffer = 0;
+		mapped = NULL;
+		capacity = 0;
+		used = 0;
+		memory.clear();
+		ready = persistent = false;
+	}
+
+private:
+	bool ready;
+	bool persistent;
+	PFNGLBUFFERSTORAGEPROC_RING bufferStorage;
+	unsigned int buffer;
+	unsigned char *mapped;		// whole buffer, persistent mapping only
+	unsigned char *writing;		// current segment while writing
+	size_t stride;
+	size_t capacity;			// transforms per segment
+	int segment;
+	size_t used;
+	GLsync fences[SEGMENTS];
+	MemoryAccount memory;
+
+	size_t segmentBytes() const { return capacity * stride; }
+
+	static bool hasBufferStorage()
+	{
+		GLint major = 0, minor = 0;
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+		if (major > 4 || (major == 4 && minor >= 4))
+			return true;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; i++) {
+			const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (name && strcmp(name, "GL_ARB_buffer_storage") == 0)
+				return true;
+		}
+		return false;
+	}
+
+	void waitFence(int index)
+	{
+		if (!fences[index])
+			return;
+		GLenum result = glClientWaitSync(fences[index], 0, 0);
+		if (result == GL_TIMEOUT_EXPIRED) {
+			waits++;
+			do {
+				result = glClientWaitSync(fences[index], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+			} while (result == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(fences[index]);
+		fences[index] = 0;
+	}
+
+	// growing replaces the buffer, the only time all segments are waited for
+	void allocate(size_t count)
+	{
+		if (!ready)
+			cout << "ERROR::TRANSFORMS:: setup was not called" << endl;
+		for (int i = 0; i < SEGMENTS; i++)
+			waitFence(i);
+		if (buffer) {
+			if (persistent) {
+				glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+				glUnmapBuffer(GL_UNIFORM_BUFFER);
+			}
+			glDeleteBuffers(1, &buffer);
+		}
+
+		capacity = std::max<size_t>(count, 64);
+		GLsizeiptr bytes = SEGMENTS * segmentBytes();
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+		if (persistent) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			bufferStorage(GL_UNIFORM_BUFFER, bytes, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, bytes, flags);
+		}
+		else {
+			glBufferData(GL_UNIFORM_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		memory.set(MEM_GPU_STREAM, bytes);
+	}
+};
+
+#endif